@@ -6,6 +6,31 @@
 #include <vector>
 #include <sstream>
 #include <thread>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/// Number of heap allocations made by the process, counted to check that processing a
+/// frame makes none
+static std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
 
 void report(const libkio::Frame& frame, std::size_t frame_count, const std::chrono::duration<float>& duration)
 {
@@ -16,9 +41,33 @@ void report(const libkio::Frame& frame, std::size_t frame_count, const std::chro
     std::cout << std::endl;
 }
 
+/// Returns the ratio of the busiest thread's time to the mean, 1 is perfectly balanced
+float imbalance(const std::vector<float>& busy)
+{
+    float max(0);
+    float sum(0);
+    for (auto b : busy) {
+        max = std::max(max, b);
+        sum += b;
+    }
+    return sum > 0 ? max * busy.size() / sum : 1.0f;
+}
+
+void report_busy(const std::vector<float>& busy)
+{
+    if (!busy.empty()) {
+        std::cout << "    thread busy time";
+        for (auto b : busy) {
+            std::cout << " " << b << "s";
+        }
+        std::cout << " (imbalance " << imbalance(busy) << ")" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
 void print_usage(const char* arg0)
 {
-    std::cerr << "usage: " << arg0 << " [-h] [-H] [-f frames] [-t threads]" << std::endl;
+    std::cerr << "usage: " << arg0 << " [-h] [-H] [-f frames] [-t threads] [-r widthxheight] [-p distance] [-s bytes] [-z tile_size] [-a none|core|numa] [-q depth] [-B batch] [-V views] [-X layers] [-m] [-A] [-d deadline] [-P factor] [-g] [-S] [-O megabytes] [-M] [-R] [-o x,y] [-I] [-C] [-T profile]" << std::endl;
 }
 
 void print_help(const char* arg0)
@@ -28,16 +77,162 @@ void print_help(const char* arg0)
     std::cerr << "    -H                enable heuristics mode" << std::endl;
     std::cerr << "    -f frames         number of frames to render            (default 100)" << std::endl;
     std::cerr << "    -t threads        number of threads in normal mode      (default 1)" << std::endl;
+    std::cerr << "    -r widthxheight   frame resolution                      (default 1920x1080)" << std::endl;
+    std::cerr << "    -p distance       source prefetch distance in pixels    (default 0)" << std::endl;
+    std::cerr << "    -s bytes          streaming store frame size threshold  (default library)" << std::endl;
+    std::cerr << "    -z tile_size      multithreaded tile size in pixels     (default library)" << std::endl;
+    std::cerr << "    -a affinity       thread placement, none, core or numa  (default none)" << std::endl;
+    std::cerr << "    -q depth          frames in flight with submit and wait (default 0, process)" << std::endl;
+    std::cerr << "    -B batch          frames per call to process_batch      (default 0, process)" << std::endl;
+    std::cerr << "    -V views          views per call to process_views, each a segment more (default 0, process)" << std::endl;
+    std::cerr << "    -X layers         layers blended by process_blended, each a segment more (default 0, process)" << std::endl;
+    std::cerr << "    -m                process through a precomputed remap table" << std::endl;
+    std::cerr << "    -A                count heap allocations per frame, failing if any are made" << std::endl;
+    std::cerr << "    -d deadline       frame deadline in milliseconds, reporting the quality of each frame" << std::endl;
+    std::cerr << "    -P factor         proxy grid factor, 1, 2, 4 or 8       (default 1)" << std::endl;
+    std::cerr << "    -g                report the time of each progressive rendering pass" << std::endl;
+    std::cerr << "    -S                cache a tiled copy of the static input frame, with -m" << std::endl;
+    std::cerr << "    -O megabytes      budget of the cache of rendered frames (default 0, disabled)" << std::endl;
+    std::cerr << "    -M                gather from a mirror padded copy of the input frame" << std::endl;
+    std::cerr << "    -R                leave pixels outside the source unwritten rather than reflecting" << std::endl;
+    std::cerr << "    -o x,y            origin as fractions of the frame size (default 0.5,0.5)" << std::endl;
+    std::cerr << "    -I                process in place, reporting the source footprint" << std::endl;
+    std::cerr << "    -C                check the output of each segmentation against plain process, failing on a mismatch" << std::endl;
+    std::cerr << "    -T profile        tune the thread count and tile size, writing the results to profile" << std::endl;
     std::cerr << "    -h                help" << std::endl;
 }
 
+/// Settings the reference frames of -C share with the instance they check
+struct Check_settings {
+    float origin_x;
+    float origin_y;
+    std::uint32_t proxy_factor;
+    bool reflect;
+};
+
+/// Renders \p in into \p out with plain process and only the settings that change the output,
+/// \p out holds the pixels the effect leaves unwritten
+void render_reference(const libkio::Frame& frame, const Check_settings& settings, std::uint32_t segmentation, const std::uint8_t* in, std::uint8_t* out)
+{
+    std::unique_ptr<libkaleidoscope::IKaleidoscope> k(libkaleidoscope::IKaleidoscope::factory(frame.width, frame.height, frame.comp_size, frame.n_comp));
+    k->set_origin(settings.origin_x, settings.origin_y);
+    k->set_proxy_factor(settings.proxy_factor);
+    k->set_reflect_edges(settings.reflect);
+    k->set_segmentation(segmentation);
+    k->process(in, out);
+}
+
+/// Compares the output of \p mode with the reference, reporting the result
+/// @return \c true if they are the same
+bool check_output(const std::string& mode, std::uint32_t segmentation, const std::uint8_t* out, const std::vector<std::uint8_t>& expected)
+{
+    std::size_t mismatches(0);
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+        mismatches += out[i] != expected[i];
+    }
+    if (mismatches) {
+        std::cerr << "check failed: " << mode << " at segmentation " << segmentation << " differs from process in " << mismatches << " bytes" << std::endl;
+        return false;
+    }
+    std::cout << "    check " << mode << " ok" << std::endl;
+    return true;
+}
+
+/// Times \p frame_count frames processed by \p k
+float time_frames(libkaleidoscope::IKaleidoscope* k, const libkio::Frame& frame_in, libkio::Frame& frame_out, std::uint32_t frame_count)
+{
+    // preprocess
+    k->process(frame_in.data.get(), frame_out.data.get());
+    auto start = std::chrono::steady_clock::now();
+    for (std::uint32_t i = 0; i < frame_count; ++i) {
+        k->process(frame_in.data.get(), frame_out.data.get());
+    }
+    return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Finds the fastest thread count and tile size for each segmentation and mode at the
+/// frame's resolution and writes them to the tuning profile \p path
+int tune(libkaleidoscope::IKaleidoscope* k, const libkio::Frame& frame_in, libkio::Frame& frame_out, std::uint32_t frame_count, const std::string& path)
+{
+    std::ofstream profile(path, std::ios::app);
+    if (!profile) {
+        std::cerr << "Error: could not open " << path << " for writing." << std::endl;
+        return 1;
+    }
+    libkaleidoscope::IKaleidoscope::set_global_threading(0);
+    std::uint32_t max_threads = libkaleidoscope::IKaleidoscope::get_global_threading();
+    std::vector<std::uint32_t> threads;
+    for (std::uint32_t t = 1; t < max_threads; t *= 2) {
+        threads.push_back(t);
+    }
+    threads.push_back(max_threads);
+    const std::uint32_t segs[] = { 2, 4, 8, 12, 16, 24, 32, 64, 128 };
+    const std::uint32_t tile_sizes[] = { 16, 32, 64, 128, 256 };
+    std::uint32_t default_tile_size = k->get_tile_size();
+    std::uint8_t background[4] = { 0, 0, 0, 0xff };
+    k->set_background_colour(background);
+
+    profile << "# width height pixel_size segmentation mode threads tile_size" << std::endl;
+    for (int reflect = 1; reflect >= 0; --reflect) {
+        k->set_reflect_edges(reflect != 0);
+        for (auto seg : segs) {
+            k->set_segmentation(seg);
+            float best(-1);
+            std::uint32_t best_threads(1);
+            std::uint32_t best_tile_size(default_tile_size);
+            for (auto t : threads) {
+                k->set_threading(t);
+                for (auto tile_size : tile_sizes) {
+                    // a single thread processes the whole frame at once so the tile size doesn't matter
+                    k->set_tile_size(t == 1 ? default_tile_size : tile_size);
+                    float duration = time_frames(k, frame_in, frame_out, frame_count);
+                    if (best < 0 || duration < best) {
+                        best = duration;
+                        best_threads = t;
+                        best_tile_size = k->get_tile_size();
+                    }
+                    if (t == 1) {
+                        break;
+                    }
+                }
+            }
+            profile << frame_in.width << " " << frame_in.height << " " << frame_in.comp_size * frame_in.n_comp << " "
+                    << seg << " " << (reflect ? "reflect" : "background") << " " << best_threads << " " << best_tile_size << std::endl;
+            std::cout << "segmentation " << seg << (reflect ? " reflect" : " background") << ": " << best_threads
+                      << " threads, tile size " << best_tile_size << " (" << frame_count / best << " f/sec)" << std::endl;
+        }
+    }
+    return 0;
+}
+
 #define VALIDATE_IDX(_msg) { if ((i) >= argc) { throw std::string(_msg); } }
 
 int main(int argc, char** argv)
 {
-    libkio::Frame frame_in(1920, 1080, 1, 4);
-    libkio::Frame frame_out(1920, 1080, 1, 4);
-    std::unique_ptr<libkaleidoscope::IKaleidoscope> k(libkaleidoscope::IKaleidoscope::factory(frame_in.width, frame_in.height, frame_in.comp_size, frame_in.n_comp));
+    std::uint32_t width(1920);
+    std::uint32_t height(1080);
+    std::uint32_t prefetch_distance(0);
+    std::int64_t streaming_threshold(-1);
+    std::uint32_t tile_size(0);
+    std::uint32_t depth(0);
+    std::uint32_t batch(0);
+    std::uint32_t n_views(0);
+    std::uint32_t n_layers(0);
+    std::string profile;
+    bool remap_table(false);
+    bool count_allocations(false);
+    float deadline(0);
+    std::uint32_t proxy_factor(1);
+    bool progressive(false);
+    bool source_cache(false);
+    std::uint64_t output_cache(0);
+    bool mirror_padding(false);
+    bool reflect(true);
+    bool in_place(false);
+    bool check(false);
+    float origin_x(0.5f);
+    float origin_y(0.5f);
+    libkaleidoscope::IKaleidoscope::Affinity affinity(libkaleidoscope::IKaleidoscope::Affinity::NONE);
     std::uint32_t n_threads(1);
     bool heuristics(false);
     std::uint32_t frame_count(100);
@@ -70,6 +265,151 @@ int main(int argc, char** argv)
                     print_usage(argv[0]);
                     return 1;
                 }
+            } else if (arg == "-r") {
+                // resolution
+                i++;
+                VALIDATE_IDX("-r has no argument");
+                std::stringstream ss(argv[i]);
+                char x;
+                ss >> width >> x >> height;
+                if (ss.fail() || !ss.eof() || x != 'x' || width == 0 || height == 0 || width % 4 != 0) {
+                    throw "Could not convert -r argument " + std::string(argv[i]) + " to a resolution. Width must be a multiple of 4.";
+                }
+            } else if (arg == "-p") {
+                // prefetch distance
+                i++;
+                VALIDATE_IDX("-p has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> prefetch_distance;
+                if (ss.fail() || !ss.eof()) {
+                    throw "Could not convert -p argument " + std::string(argv[i]) + " to an integer.";
+                }
+            } else if (arg == "-s") {
+                // streaming store threshold
+                i++;
+                VALIDATE_IDX("-s has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> streaming_threshold;
+                if (ss.fail() || !ss.eof() || streaming_threshold < 0) {
+                    throw "Could not convert -s argument " + std::string(argv[i]) + " to an integer.";
+                }
+            } else if (arg == "-z") {
+                // tile size
+                i++;
+                VALIDATE_IDX("-z has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> tile_size;
+                if (ss.fail() || !ss.eof()) {
+                    throw "Could not convert -z argument " + std::string(argv[i]) + " to an integer.";
+                }
+            } else if (arg == "-a") {
+                // thread affinity
+                i++;
+                VALIDATE_IDX("-a has no argument");
+                std::string a(argv[i]);
+                if (a == "none") {
+                    affinity = libkaleidoscope::IKaleidoscope::Affinity::NONE;
+                } else if (a == "core") {
+                    affinity = libkaleidoscope::IKaleidoscope::Affinity::CORE;
+                } else if (a == "numa") {
+                    affinity = libkaleidoscope::IKaleidoscope::Affinity::NUMA;
+                } else {
+                    throw "Unknown -a argument " + a + ", expected none, core or numa.";
+                }
+            } else if (arg == "-q") {
+                // frames in flight
+                i++;
+                VALIDATE_IDX("-q has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> depth;
+                if (ss.fail() || !ss.eof()) {
+                    throw "Could not convert -q argument " + std::string(argv[i]) + " to an integer.";
+                }
+            } else if (arg == "-B") {
+                // frames per batch
+                i++;
+                VALIDATE_IDX("-B has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> batch;
+                if (ss.fail() || !ss.eof()) {
+                    throw "Could not convert -B argument " + std::string(argv[i]) + " to an integer.";
+                }
+            } else if (arg == "-V") {
+                // views per call to process_views
+                i++;
+                VALIDATE_IDX("-V has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> n_views;
+                if (ss.fail() || !ss.eof()) {
+                    throw "Could not convert -V argument " + std::string(argv[i]) + " to an integer.";
+                }
+            } else if (arg == "-X") {
+                // layers per call to process_blended
+                i++;
+                VALIDATE_IDX("-X has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> n_layers;
+                if (ss.fail() || !ss.eof()) {
+                    throw "Could not convert -X argument " + std::string(argv[i]) + " to an integer.";
+                }
+            } else if (arg == "-m") {
+                remap_table = true;
+            } else if (arg == "-A") {
+                count_allocations = true;
+            } else if (arg == "-d") {
+                // frame deadline
+                i++;
+                VALIDATE_IDX("-d has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> deadline;
+                if (ss.fail() || !ss.eof() || deadline < 0) {
+                    throw "Could not convert -d argument " + std::string(argv[i]) + " to a number of milliseconds.";
+                }
+            } else if (arg == "-P") {
+                // proxy factor
+                i++;
+                VALIDATE_IDX("-P has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> proxy_factor;
+                if (ss.fail() || !ss.eof()) {
+                    throw "Could not convert -P argument " + std::string(argv[i]) + " to an integer.";
+                }
+            } else if (arg == "-g") {
+                progressive = true;
+            } else if (arg == "-S") {
+                source_cache = true;
+            } else if (arg == "-O") {
+                // output cache budget
+                i++;
+                VALIDATE_IDX("-O has no argument");
+                std::stringstream ss(argv[i]);
+                ss >> output_cache;
+                if (ss.fail() || !ss.eof()) {
+                    throw "Could not convert -O argument " + std::string(argv[i]) + " to an integer.";
+                }
+            } else if (arg == "-M") {
+                mirror_padding = true;
+            } else if (arg == "-R") {
+                reflect = false;
+            } else if (arg == "-I") {
+                in_place = true;
+            } else if (arg == "-C") {
+                check = true;
+            } else if (arg == "-o") {
+                // origin
+                i++;
+                VALIDATE_IDX("-o has no argument");
+                std::stringstream ss(argv[i]);
+                char comma(0);
+                ss >> origin_x >> comma >> origin_y;
+                if (ss.fail() || !ss.eof() || comma != ',') {
+                    throw "Could not convert -o argument " + std::string(argv[i]) + " to an origin.";
+                }
+            } else if (arg == "-T") {
+                // tuning profile
+                i++;
+                VALIDATE_IDX("-T has no argument");
+                profile = argv[i];
             } else if (arg == "-h") {
                 print_help(argv[0]);
                 return 1;
@@ -81,6 +421,93 @@ int main(int argc, char** argv)
         return 1;
 
     }
+    libkaleidoscope::IKaleidoscope::set_global_affinity(affinity);
+    libkio::Frame frame_in(width, height, 1, 4);
+    libkio::Frame frame_out(width, height, 1, 4);
+    // an output frame for each frame in flight, in a batch, view or layer
+    std::vector<std::unique_ptr<libkio::Frame>> frames_out;
+    for (std::uint32_t i = 0; i < std::max(std::max(depth, batch), std::max(n_views, n_layers)); ++i) {
+        frames_out.emplace_back(new libkio::Frame(width, height, 1, 4));
+    }
+    // every frame of a batch is processed from the same input
+    std::vector<const void*> batch_in(batch, frame_in.data.get());
+    std::vector<void*> batch_out;
+    for (std::uint32_t i = 0; i < batch; ++i) {
+        batch_out.push_back(frames_out[i]->data.get());
+    }
+    std::unique_ptr<libkaleidoscope::IKaleidoscope> k(libkaleidoscope::IKaleidoscope::factory(frame_in.width, frame_in.height, frame_in.comp_size, frame_in.n_comp));
+    if (k->set_prefetch_distance(prefetch_distance) != 0) {
+        std::cerr << "Error: prefetch distance " << prefetch_distance << " is out of range." << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (tile_size && k->set_tile_size(tile_size) != 0) {
+        std::cerr << "Error: tile size " << tile_size << " is not a multiple of 4." << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (streaming_threshold >= 0) {
+        k->set_streaming_threshold(static_cast<std::uint32_t>(streaming_threshold));
+    }
+
+    k->set_remap_table(remap_table);
+    k->set_source_cache(source_cache);
+    k->set_output_cache(output_cache * 1024 * 1024);
+    k->set_mirror_padding(mirror_padding);
+    k->set_reflect_edges(reflect);
+    if (k->set_origin(origin_x, origin_y) != 0) {
+        std::cerr << "Error: origin " << origin_x << "," << origin_y << " is outside the frame." << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    k->set_frame_deadline(deadline / 1000);
+    if (k->set_proxy_factor(proxy_factor) != 0) {
+        std::cerr << "Error: proxy factor " << proxy_factor << " is not 1, 2, 4 or 8." << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!profile.empty()) {
+        return tune(k.get(), frame_in, frame_out, frame_count, profile);
+    }
+    if (check && (deadline > 0 || mirror_padding)) {
+        // reduced quality frames and the mirror padding at the exact frame edges differ by design
+        std::cerr << "Error: -C cannot check frames processed with -d or -M." << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    // the frames are checked from random content, starting from other random content so
+    // that pixels left unwritten are checked too
+    const std::size_t frame_size = static_cast<std::size_t>(width) * height * frame_in.comp_size * frame_in.n_comp;
+    std::vector<std::uint8_t> check_in(check ? frame_size : 0);
+    std::vector<std::uint8_t> check_initial(check_in.size());
+    std::uint32_t random(1);
+    for (std::size_t i = 0; i < check_in.size(); ++i) {
+        random = random * 1664525 + 1013904223;
+        check_in[i] = static_cast<std::uint8_t>(random >> 24);
+        check_initial[i] = static_cast<std::uint8_t>(random >> 16);
+    }
+    const Check_settings check_settings = { origin_x, origin_y, proxy_factor, reflect };
+
+    // the views and layers share the origin and mapping settings, each has one more segment than the last
+    std::vector<std::unique_ptr<libkaleidoscope::IKaleidoscope>> views;
+    std::vector<libkaleidoscope::IKaleidoscope*> view_ptrs;
+    std::vector<void*> views_out;
+    // the layers are blended equally
+    std::vector<float> weights(n_layers, 1.0f / std::max<std::uint32_t>(n_layers, 1));
+    for (std::uint32_t i = 0; i < std::max(n_views, n_layers); ++i) {
+        views.push_back(libkaleidoscope::IKaleidoscope::factory(frame_in.width, frame_in.height, frame_in.comp_size, frame_in.n_comp));
+        if (tile_size) {
+            views.back()->set_tile_size(tile_size);
+        }
+        views.back()->set_remap_table(remap_table);
+        views.back()->set_origin(origin_x, origin_y);
+        views.back()->set_proxy_factor(proxy_factor);
+        views.back()->set_reflect_edges(reflect);
+        view_ptrs.push_back(views.back().get());
+        views_out.push_back(frames_out[i]->data.get());
+    }
+
     std::vector<std::int32_t> segs;
     std::vector<std::uint32_t> threads;
 
@@ -91,8 +518,18 @@ int main(int argc, char** argv)
         segs = { 2, 4, 8, 12, 16, 24, 32, 64, 128 };
         threads = { n_threads };
     }
+    // threads come from a process wide pool, make sure it's big enough for every test
+    libkaleidoscope::IKaleidoscope::set_global_threading(*std::max_element(threads.begin(), threads.end()));
+    // place the frames on the nodes that will process them
+    k->set_threading(threads.back());
+    k->first_touch(frame_in.data.get());
+    k->first_touch(frame_out.data.get());
+    // processing in place overwrites the input, the timing doesn't depend on its content
+    void* out_frame = in_place ? frame_in.data.get() : frame_out.data.get();
     std::chrono::duration<float> total(0);
     std::size_t total_frames(0);
+    std::size_t total_allocations(0);
+    std::vector<std::vector<float>> imbalances;
     if (heuristics) {
         std::cout << "native_threads:" << std::thread::hardware_concurrency();
         for (auto seg : segs) {
@@ -102,31 +539,267 @@ int main(int argc, char** argv)
     }
     for (auto t: threads) {
         k->set_threading(t);
+        for (auto& view : views) {
+            view->set_threading(t);
+        }
         //std::vector<std::chrono::duration<float>> totals;
         if (heuristics) {
             std::cout << t;
         }
+        imbalances.push_back(std::vector<float>());
         for (auto seg : segs) {
             k->set_segmentation(seg);
+            for (std::uint32_t i = 0; i < views.size(); ++i) {
+                views[i]->set_segmentation(seg + i);
+            }
+            if (n_views) {
+                libkaleidoscope::IKaleidoscope::process_views(view_ptrs.data(), frame_in.data.get(), views_out.data(), n_views);
+            }
 
-            // preprocess
-            k->process(frame_in.data.get(), frame_out.data.get());
+            // preprocess, the source cache copies the input on the second frame it is unchanged
+            k->process(frame_in.data.get(), out_frame);
+            if (source_cache) {
+                k->process(frame_in.data.get(), out_frame);
+            }
+            if (depth) {
+                std::vector<std::uint64_t> tickets(depth);
+                for (std::uint32_t i = 0; i < depth; ++i) {
+                    k->submit(frame_in.data.get(), frames_out[i]->data.get(), &tickets[i]);
+                }
+                for (auto ticket : tickets) {
+                    k->wait(ticket);
+                }
+            }
 
             std::chrono::duration<float> duration(0);
+            std::vector<float> busy;
+            // allocations made by the library while processing, not by the timing loop
+            std::size_t frame_allocations(0);
+            // number of frames processed at each quality
+            std::vector<std::size_t> qualities(3);
             if (!heuristics) {
                 std::cout << frame_count << " tests at segmentation " << seg << " (" << frame_in.width << "," << frame_in.height << ")" << std::endl;
+                if (remap_table) {
+                    std::cout << "remap table built in " << k->get_remap_build_time() * 1000 << " ms" << std::endl;
+                }
+                if (in_place) {
+                    std::uint32_t x, y, width, height;
+                    k->get_source_footprint(&x, &y, &width, &height);
+                    std::cout << "source footprint " << width << "x" << height << " at " << x << "," << y << std::endl;
+                }
+            }
+            if (depth) {
+                // keep depth frames in flight, the busy times aren't reported
+                std::deque<std::uint64_t> tickets;
+                auto start = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < frame_count; ++i) {
+                    if (tickets.size() == depth) {
+                        std::size_t before = allocations;
+                        k->wait(tickets.front());
+                        frame_allocations += allocations - before;
+                        tickets.pop_front();
+                    }
+                    std::uint64_t ticket;
+                    std::size_t before = allocations;
+                    k->submit(frame_in.data.get(), frames_out[i % depth]->data.get(), &ticket);
+                    frame_allocations += allocations - before;
+                    tickets.push_back(ticket);
+                }
+                for (auto ticket : tickets) {
+                    std::size_t before = allocations;
+                    k->wait(ticket);
+                    frame_allocations += allocations - before;
+                }
+                duration += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            }
+            if (batch) {
+                auto start = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < frame_count; i += batch) {
+                    std::size_t before = allocations;
+                    k->process_batch(batch_in.data(), batch_out.data(), static_cast<std::uint32_t>(std::min<std::size_t>(batch, frame_count - i)));
+                    frame_allocations += allocations - before;
+                }
+                duration += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            }
+            // the time to render the views one by one, for comparison
+            std::chrono::duration<float> separate(0);
+            if (n_views) {
+                auto start = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < frame_count; ++i) {
+                    std::size_t before = allocations;
+                    libkaleidoscope::IKaleidoscope::process_views(view_ptrs.data(), frame_in.data.get(), views_out.data(), n_views);
+                    frame_allocations += allocations - before;
+                }
+                duration += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                start = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < frame_count; ++i) {
+                    for (std::uint32_t v = 0; v < n_views; ++v) {
+                        views[v]->process(frame_in.data.get(), views_out[v]);
+                    }
+                }
+                separate += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            }
+            // the time to render the layers one by one and blend them, for comparison
+            if (n_layers) {
+                auto start = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < frame_count; ++i) {
+                    std::size_t before = allocations;
+                    libkaleidoscope::IKaleidoscope::process_blended(view_ptrs.data(), weights.data(), frame_in.data.get(), out_frame, n_layers);
+                    frame_allocations += allocations - before;
+                }
+                duration += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                const std::size_t n_bytes = static_cast<std::size_t>(frame_in.width) * frame_in.height * frame_in.comp_size * frame_in.n_comp;
+                std::vector<float> sums(n_bytes);
+                std::uint8_t* out = static_cast<std::uint8_t*>(out_frame);
+                start = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < frame_count; ++i) {
+                    for (std::uint32_t l = 0; l < n_layers; ++l) {
+                        views[l]->process(frame_in.data.get(), views_out[l]);
+                    }
+                    std::fill(sums.begin(), sums.end(), 0.0f);
+                    for (std::uint32_t l = 0; l < n_layers; ++l) {
+                        const std::uint8_t* layer = static_cast<const std::uint8_t*>(views_out[l]);
+                        for (std::size_t b = 0; b < n_bytes; ++b) {
+                            sums[b] += weights[l] * layer[b];
+                        }
+                    }
+                    for (std::size_t b = 0; b < n_bytes; ++b) {
+                        out[b] = static_cast<std::uint8_t>(std::min(sums[b] + 0.5f, 255.0f));
+                    }
+                }
+                separate += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
             }
-            for (std::size_t i = 0; i < frame_count; ++i) {
+            for (std::size_t i = 0; i < (depth || batch || n_views || n_layers ? 0 : frame_count); ++i) {
+                std::size_t before = allocations;
                 auto start = std::chrono::steady_clock::now();
-                k->process(frame_in.data.get(), frame_out.data.get());
+                k->process(frame_in.data.get(), out_frame);
                 duration += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                frame_allocations += allocations - before;
+                qualities[static_cast<std::size_t>(k->get_frame_quality())]++;
+
+                std::vector<float> frame_busy(k->get_thread_busy_times(nullptr, 0));
+                k->get_thread_busy_times(frame_busy.data(), static_cast<std::uint32_t>(frame_busy.size()));
+                busy.resize(frame_busy.size());
+                for (std::size_t b = 0; b < busy.size(); ++b) {
+                    busy[b] += frame_busy[b];
+                }
+            }
+            if (check) {
+                std::vector<std::uint8_t> expected(check_initial);
+                render_reference(frame_in, check_settings, seg, check_in.data(), expected.data());
+                std::vector<std::uint8_t> out(check_initial);
+                k->process(check_in.data(), out.data());
+                if (!check_output(remap_table ? "remap table" : "process", seg, out.data(), expected)) {
+                    return 1;
+                }
+                if (output_cache || source_cache) {
+                    // the same input again is served from the output cache or the tiled copy
+                    std::copy(check_initial.begin(), check_initial.end(), out.begin());
+                    k->process(check_in.data(), out.data());
+                    if (!check_output(output_cache ? "memoised output" : "source cache", seg, out.data(), expected)) {
+                        return 1;
+                    }
+                }
+                if (batch) {
+                    std::vector<std::vector<std::uint8_t>> outs(batch, check_initial);
+                    std::vector<const void*> ins(batch, check_in.data());
+                    std::vector<void*> out_ptrs;
+                    for (auto& batch_frame : outs) {
+                        out_ptrs.push_back(batch_frame.data());
+                    }
+                    k->process_batch(ins.data(), out_ptrs.data(), batch);
+                    for (auto& batch_frame : outs) {
+                        if (!check_output("batch", seg, batch_frame.data(), expected)) {
+                            return 1;
+                        }
+                    }
+                }
+                if (n_views) {
+                    std::vector<std::vector<std::uint8_t>> outs(n_views, check_initial);
+                    std::vector<void*> out_ptrs;
+                    for (auto& view_frame : outs) {
+                        out_ptrs.push_back(view_frame.data());
+                    }
+                    libkaleidoscope::IKaleidoscope::process_views(view_ptrs.data(), check_in.data(), out_ptrs.data(), n_views);
+                    for (std::uint32_t v = 0; v < n_views; ++v) {
+                        std::vector<std::uint8_t> view_expected(check_initial);
+                        render_reference(frame_in, check_settings, seg + v, check_in.data(), view_expected.data());
+                        if (!check_output("view " + std::to_string(v), seg, outs[v].data(), view_expected)) {
+                            return 1;
+                        }
+                    }
+                }
+                if (n_layers) {
+                    // the layers are blended at full quality, in the order and with the rounding of process_blended
+                    Check_settings layer_settings(check_settings);
+                    layer_settings.proxy_factor = 1;
+                    std::vector<float> sums(frame_size);
+                    std::vector<std::uint8_t> layer_expected(frame_size);
+                    for (std::uint32_t l = 0; l < n_layers; ++l) {
+                        std::copy(check_initial.begin(), check_initial.end(), layer_expected.begin());
+                        render_reference(frame_in, layer_settings, seg + l, check_in.data(), layer_expected.data());
+                        for (std::size_t b = 0; b < frame_size; ++b) {
+                            sums[b] = l == 0 ? weights[l] * layer_expected[b] : sums[b] + weights[l] * layer_expected[b];
+                        }
+                    }
+                    std::vector<std::uint8_t> blend_expected(frame_size);
+                    for (std::size_t b = 0; b < frame_size; ++b) {
+                        blend_expected[b] = static_cast<std::uint8_t>(std::min(std::max(sums[b] + 0.5f, 0.0f), 255.0f));
+                    }
+                    std::copy(check_initial.begin(), check_initial.end(), out.begin());
+                    libkaleidoscope::IKaleidoscope::process_blended(view_ptrs.data(), weights.data(), check_in.data(), out.data(), n_layers);
+                    if (!check_output("blended", seg, out.data(), blend_expected)) {
+                        return 1;
+                    }
+                }
+                if (in_place) {
+                    // the pixels left unwritten keep the input
+                    std::copy(check_in.begin(), check_in.end(), expected.begin());
+                    render_reference(frame_in, check_settings, seg, check_in.data(), expected.data());
+                    std::copy(check_in.begin(), check_in.end(), out.begin());
+                    k->process(out.data(), out.data());
+                    if (!check_output("in place", seg, out.data(), expected)) {
+                        return 1;
+                    }
+                }
             }
+            imbalances.back().push_back(imbalance(busy));
             if (heuristics) {
                 //totals.push_back(duration);
                 std::cout << "," << duration.count();
             } else {
                 report(frame_in, frame_count, duration);
+                report_busy(busy);
+                if (n_views) {
+                    std::cout << "    " << n_views << " views processed separately in " << separate.count() * 1000 / frame_count << " ms/frame" << std::endl << std::endl;
+                }
+                if (n_layers) {
+                    std::cout << "    " << n_layers << " layers processed separately and blended in " << separate.count() * 1000 / frame_count << " ms/frame" << std::endl << std::endl;
+                }
+                if (deadline > 0 && !depth && !batch && !n_views && !n_layers) {
+                    std::cout << "    quality full " << qualities[0] << " half " << qualities[1] << " quarter " << qualities[2] << std::endl << std::endl;
+                }
+                if (output_cache) {
+                    std::cout << "    output cache hits " << k->get_output_cache_hits() << " misses " << k->get_output_cache_misses() << std::endl << std::endl;
+                }
+                if (progressive) {
+                    // time the passes from the coarsest down to the full resolution
+                    k->cancel_progressive();
+                    std::cout << "    progressive passes";
+                    std::uint32_t block_size(0);
+                    while (block_size != 1) {
+                        auto start = std::chrono::steady_clock::now();
+                        k->process_progressive(frame_in.data.get(), frame_out.data.get(), &block_size);
+                        std::chrono::duration<float> pass(std::chrono::steady_clock::now() - start);
+                        std::cout << " " << block_size << ": " << pass.count() * 1000 << " ms";
+                    }
+                    std::cout << std::endl << std::endl;
+                }
+                if (count_allocations) {
+                    std::cout << "    " << static_cast<float>(frame_allocations) / frame_count << " allocations/frame" << std::endl << std::endl;
+                }
             }
+            total_allocations += frame_allocations;
             total += duration;
             total_frames += frame_count;
         }
@@ -138,9 +811,27 @@ int main(int argc, char** argv)
             std::cout << std::endl;
         }
     }
-    if (!heuristics) {
+    if (heuristics) {
+        // thread imbalance in the same layout as the timings
+        std::cout << std::endl << "imbalance";
+        for (auto seg : segs) {
+            std::cout << "," << seg;
+        }
+        std::cout << std::endl;
+        for (std::size_t t = 0; t < threads.size(); ++t) {
+            std::cout << threads[t];
+            for (auto i : imbalances[t]) {
+                std::cout << "," << i;
+            }
+            std::cout << std::endl;
+        }
+    } else {
         report(frame_in, total_frames, total);
     }
+    if (count_allocations && total_allocations != 0) {
+        std::cerr << "Error: " << total_allocations << " heap allocations were made processing " << total_frames << " frames." << std::endl;
+        return 1;
+    }
 
     return 0;
 }
@@ -104,6 +104,27 @@ public:
         NONE            //< No direction
     };
 
+    ///  Defines how processing threads are placed on cores
+    enum class Affinity {
+        NONE = 0,       //< Threads are free to run on any core
+        CORE,           //< Each thread is pinned to a core
+        NUMA            //< Each thread is pinned to a core and each NUMA node processes its own band of the frame
+    };
+
+    ///  Defines how frames are processed while a remap table is rebuilt
+    enum class Remap_rebuild {
+        BLOCKING = 0,   //< Frames wait for the table to be built
+        DIRECT,         //< Frames evaluate the effect per pixel while the table is built in the background
+        PREVIOUS        //< Frames gather through the previous table while the new one is built in the background
+    };
+
+    ///  Defines the quality a frame is processed at
+    enum class Quality {
+        FULL = 0,       //< The source pixel of every output pixel is evaluated
+        HALF,           //< The source pixel is evaluated once per 2x2 block of output pixels
+        QUARTER         //< The source pixel is evaluated once per 4x4 block of output pixels
+    };
+
     /**
      * Sets the direction that the source segment rotates in. If
      * Direction::NONE then the source segment is centred on the corner.
@@ -218,6 +239,12 @@ public:
      * Applies the kaleidoscope effect to \p in_frame and returns it in \p out_frame.
      * Each parameter must point to enough memory to contain the image specified in the 
      * constructor and must be aligned to an integer multiple of 16 bytes in memory.
+     * Several threads may process frames at once, and settings may be changed while they do,
+     * each frame is processed with the settings current when it started.
+     * Once a frame has been processed with the current settings, further frames allocate no memory.
+     * \p in_frame may be \p out_frame to process in place, the region of the input read by
+     * the settings (see #get_source_footprint) is then copied aside first and the effect is
+     * evaluated rather than gathered through a remap table.
      * @param in_frame the input frame to process
      * @param out_frame receives the output image
      * @return
@@ -228,10 +255,89 @@ public:
     virtual std::int32_t process(const void* in_frame, void* out_frame) = 0;
 
     /**
-     * Sets the number of threads to use when processing.
+     * Starts applying the kaleidoscope effect to \p in_frame, into \p out_frame, on the
+     * process wide threads and returns without waiting so several frames can be in flight
+     * at once. Small frames are each processed by a single thread, running side by side,
+     * while large frames are split between the threads as with #process.
+     * Each frame is processed with the settings current when it was submitted. Both frames
+     * must remain valid, and \p out_frame must not be read, until the frame has been waited for.
+     * As with #process, steady state submitting and waiting allocate no memory. Unlike
+     * #process the frames must differ.
+     * @param in_frame the input frame to process
+     * @param out_frame receives the output image
+     * @param ticket receives the ticket to pass to #wait
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr or \p in_frame is \p out_frame)
+     */
+    virtual std::int32_t submit(const void* in_frame, void* out_frame, std::uint64_t* ticket) = 0;
+
+    /**
+     * Waits for a frame started with #submit to complete, helping to process it. Every
+     * submitted frame must be waited for exactly once, tickets may be waited for in any order
+     * and from any thread.
+     * @param ticket the ticket returned by #submit
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (unknown ticket)
+     */
+    virtual std::int32_t wait(std::uint64_t ticket) = 0;
+
+    /**
+     * Applies the kaleidoscope effect to \p count frames with the same settings, scheduling
+     * the tiles of every frame on the process wide threads as a single job. Each thread
+     * works through a run of whole frames and steals tiles from the runs of other threads
+     * once it finishes, so small frames are processed side by side while the last ones are
+     * split between the threads. The settings, remap table and thread count are looked up
+     * once for the whole batch. Frames are processed at full quality, without the frame
+     * deadline, mirror padding or the source and output caches. No output frame may be one
+     * of the input frames or the output frame of another frame.
+     * @param in_frames the \p count input frames to process
+     * @param out_frames the \p count frames to receive the output images
+     * @param count the number of frames
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr, an output frame is an input frame or another output frame, or too many tiles)
+     */
+    virtual std::int32_t process_batch(const void* const* in_frames, void* const* out_frames, std::uint32_t count) = 0;
+
+    /**
+     * Renders \p in_frame into \p out_frame progressively, for interactive changes such as
+     * dragging the origin. The first call fills \p out_frame coarsely, evaluating the effect
+     * once per 8x8 block of pixels, and each following call refines it to 4x4, 2x2 and then
+     * every pixel. Each pass only evaluates the pixels earlier passes skipped, so together
+     * they cost about as much as #process. Changing any setting, passing different frames or
+     * calling #cancel_progressive abandons the refinement and starts again from the coarsest pass.
+     * @param in_frame the input frame to process
+     * @param out_frame receives the output image, it must not be modified between passes
+     * @param block_size receives the width and height of the blocks \p out_frame is now
+     * evaluated at, \c 1 once it is at full quality
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr or \p in_frame is \p out_frame, later passes read the input)
+     */
+    virtual std::int32_t process_progressive(const void* in_frame, void* out_frame, std::uint32_t* block_size) = 0;
+
+    /**
+     * Abandons progressive rendering so that the next call to #process_progressive starts
+     * again from the coarsest pass, for when the content of the input frame changes.
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t cancel_progressive() = 0;
+
+    /**
+     * Sets the number of threads to use when processing. Threads come from a process
+     * wide pool shared by every instance so the count is limited by #set_global_threading.
      * Default to 0.
-     * @param threading the nubmer of threads to use. \c 0, calculate automatically,
-     * otherwise the explicit thread count.
+     * @param threading the nubmer of threads to use. \c 0, use every thread available, or the
+     * thread count and tile size from the tuning profile if it has an entry for the frame format
+     * (see #load_tuning_profile), otherwise the explicit thread count.
      * @return
      *          -  0: Success
      *          - -1: Error
@@ -243,6 +349,293 @@ public:
      */
     virtual std::uint32_t get_threading() const = 0;
 
+    /**
+     * When processing with multiple threads the frame is divided into square tiles which
+     * are dealt out to the threads. Threads that run out of tiles steal them from threads
+     * that are still busy so uneven per pixel costs don't leave threads idle.
+     * Defaults to 64.
+     * @param size the tile width and height in pixels, must be a non zero multiple of 4.
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Parameter out of range
+     */
+    virtual std::int32_t set_tile_size(std::uint32_t size) = 0;
+
+    /**
+     * Returns the tile size.
+     */
+    virtual std::uint32_t get_tile_size() const = 0;
+
+    /**
+     * Enables online tuning. While processing frames with #process and threading set to \c 0,
+     * neighbouring thread counts and tile sizes are tried for a few frames at a time and the
+     * fastest kept, starting from the tuning profile's choice. Useful for long renders where
+     * the best choice differs from the profile or the machine's load changes.
+     * Defaults to \c false.
+     * @param enabled \c true to enable online tuning
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_auto_tuning(bool enabled) = 0;
+
+    /**
+     * Returns \c true if online tuning is enabled.
+     */
+    virtual bool get_auto_tuning() const = 0;
+
+    /**
+     * Returns the time each thread spent processing the last frame, making load imbalance
+     * between threads visible.
+     * @param busy_times receives the busy time of each thread in seconds, may be \c nullptr
+     * @param count the number of entries \p busy_times can hold
+     * @return the number of threads that processed the last frame
+     */
+    virtual std::uint32_t get_thread_busy_times(float* busy_times, std::uint32_t count) const = 0;
+
+    /**
+     * Enables processing through a remap table. The table holds the source pixel of every
+     * output pixel so, once built, each frame is a plain gather instead of evaluating the
+     * effect per pixel. The table is built in parallel on the processing threads by the
+     * first frame after a setting that changes the mapping, or in the background (see
+     * #set_remap_rebuild), the time this takes is reported by #get_remap_build_time rather
+     * than in the thread busy times.
+     * Tables are shared through a process wide cache by every instance with the same frame
+     * geometry and mapping settings, so only the first of them builds it
+     * (see #set_mapping_cache_budget).
+     * The table uses 4 bytes per pixel. Frames larger than 4GB are processed without it.
+     * Defaults to \c false.
+     * @param enabled \c true to process through a remap table
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_remap_table(bool enabled) = 0;
+
+    /**
+     * Returns \c true if processing through a remap table is enabled.
+     */
+    virtual bool get_remap_table() const = 0;
+
+    /**
+     * Returns the time, in seconds, taken to build or fetch from the cache the most recent
+     * remap table or \c 0 if none has been built.
+     */
+    virtual float get_remap_build_time() const = 0;
+
+    /**
+     * Sets how frames are processed while the remap table is rebuilt after a setting that
+     * changes the mapping. With Remap_rebuild::BLOCKING the next frame builds the table
+     * using the processing threads. Otherwise the table is built on a background thread of
+     * the instance, started as soon as the setting changes, only the table for the latest
+     * settings is built, and frames processed meanwhile either evaluate the effect directly
+     * (Remap_rebuild::DIRECT) or gather through the table of earlier settings
+     * (Remap_rebuild::PREVIOUS, see #get_frame_stale). The new table is swapped in once built.
+     * Defaults to Remap_rebuild::BLOCKING.
+     * @param rebuild how the table is rebuilt
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_remap_rebuild(Remap_rebuild rebuild) = 0;
+
+    /**
+     * Returns how frames are processed while the remap table is rebuilt.
+     */
+    virtual Remap_rebuild get_remap_rebuild() const = 0;
+
+    /**
+     * Returns \c true if the last frame processed by #process gathered through the remap
+     * table of earlier settings while the table for the current settings was rebuilt.
+     */
+    virtual bool get_frame_stale() const = 0;
+
+    /**
+     * Enables caching a tiled copy of a static input frame. Each frame processed with
+     * #process through a remap table is fingerprinted and, while the input is unchanged,
+     * gathered from a copy laid out in tiles of 4x4 pixels with the remap table translated
+     * to it, so gathers across rows read fewer cache lines. The copy is made by the second
+     * frame with the same input and uses as much memory as the input frame and the table.
+     * The fingerprint reads the whole input frame, so this only pays off when gathers are
+     * limited by cache misses rather than memory bandwidth.
+     * Has no effect without a remap table. Defaults to \c false.
+     * @param enabled \c true to cache a tiled copy of static input frames
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_source_cache(bool enabled) = 0;
+
+    /**
+     * Returns \c true if caching a tiled copy of static input frames is enabled.
+     */
+    virtual bool get_source_cache() const = 0;
+
+    /**
+     * Sets the memory budget of the cache of frames rendered by #process, for scrubbing over
+     * still images. Frames are keyed by a fingerprint of the input frame and a hash of the
+     * settings that affect the output, a frame already in the cache is copied to the output
+     * rather than processed. The least recently used frames are dropped when the budget is
+     * reached. Frames are only cached at full quality, and not at all in background mode
+     * without a background colour as the output then depends on the previous output.
+     * The fingerprint reads the whole input frame. Defaults to \c 0, disabled.
+     * @param bytes the budget in bytes, \c 0 to disable the cache
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_output_cache(std::uint64_t bytes) = 0;
+
+    /**
+     * Returns the memory budget of the cache of rendered frames in bytes.
+     */
+    virtual std::uint64_t get_output_cache() const = 0;
+
+    /**
+     * Returns the number of frames copied from the cache of rendered frames.
+     */
+    virtual std::uint64_t get_output_cache_hits() const = 0;
+
+    /**
+     * Returns the number of frames processed with the cache of rendered frames enabled
+     * that were not in it.
+     */
+    virtual std::uint64_t get_output_cache_misses() const = 0;
+
+    /**
+     * Enables gathering from a mirror padded copy of the input frame when reflecting back
+     * into the image. Each frame processed with #process evaluating the effect directly,
+     * without a remap table, first copies the input into a larger frame whose border holds
+     * the reflected tessellation out to the furthest source pixel of the current settings,
+     * so pixels are gathered without folding coordinates back into the image. Pays off for
+     * origins off the centre of the frame, where many pixels land outside it, at the cost
+     * of the copy and its memory, which grows with the distance from the origin to the
+     * furthest corner. Only has an effect when built with SSE2. Defaults to \c false.
+     * @param enabled \c true to gather from a mirror padded copy of the input
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_mirror_padding(bool enabled) = 0;
+
+    /**
+     * Returns \c true if gathering from a mirror padded copy of the input is enabled.
+     */
+    virtual bool get_mirror_padding() const = 0;
+
+    /**
+     * Returns the rectangle of the input frame read with the current settings. Every output
+     * pixel maps into the source segment, so only the part of the input it covers, folded
+     * back into the frame when reflecting, is read. Hosts may decode just this region and
+     * leave the rest of the input frame unset. The rectangle is bounded from the geometry
+     * of the source segment, so may be a pixel or so larger than the pixels actually read.
+     * @param x receives the left column
+     * @param y receives the top row
+     * @param width receives the width in pixels
+     * @param height receives the height in pixels
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr)
+     */
+    virtual std::int32_t get_source_footprint(std::uint32_t* x, std::uint32_t* y, std::uint32_t* width, std::uint32_t* height) const = 0;
+
+    /**
+     * Sets the time #process has to complete each frame in, for real time playback. When
+     * frames are predicted to take longer, from the measured times of recent frames, they
+     * are processed at a reduced Quality that evaluates the effect for blocks of pixels
+     * rather than every pixel. Full quality is tried again from time to time so that it
+     * is restored once frames fit in the deadline. Defaults to \c 0, no deadline.
+     * @param seconds the frame deadline in seconds or \c 0 to always process at full quality
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Parameter out of range
+     */
+    virtual std::int32_t set_frame_deadline(float seconds) = 0;
+
+    /**
+     * Returns the frame deadline in seconds, \c 0 if there is none
+     */
+    virtual float get_frame_deadline() const = 0;
+
+    /**
+     * Returns the quality the last frame processed with #process was processed at.
+     * Frames started with #submit are always processed at Quality::FULL.
+     */
+    virtual Quality get_frame_quality() const = 0;
+
+    /**
+     * Sets the proxy factor for cheap previews when scrubbing or rendering thumbnails. The
+     * effect is evaluated on a grid with a spacing of \p factor pixels and the source
+     * coordinates of the pixels between are interpolated, except where a segment boundary
+     * passes between grid points which are evaluated exactly so seams stay sharp. The
+     * output frame is still full size and read from the full size input frame.
+     * Defaults to \c 1, every pixel evaluated.
+     * @param factor the grid spacing, one of 1, 2, 4 or 8
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Parameter out of range
+     */
+    virtual std::int32_t set_proxy_factor(std::uint32_t factor) = 0;
+
+    /**
+     * Returns the proxy factor
+     */
+    virtual std::uint32_t get_proxy_factor() const = 0;
+
+    /**
+     * Zero fills a newly allocated frame using the same threads, and split of the frame
+     * between them, as #process so that with Affinity::NUMA each band of the frame is
+     * first touched, and so placed in memory, on the node that processes it.
+     * @param frame the frame to fill, as given to #process
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr)
+     */
+    virtual std::int32_t first_touch(void* frame) = 0;
+
+    /**
+     * Sets how far ahead of the gather, in pixels, source coordinates are calculated so
+     * the source lines they reference can be prefetched. This helps when the rotated walk
+     * over the source image defeats the hardware prefetcher, typically on large frames.
+     * The distance is rounded up to a multiple of 4. Only has an effect when built with SSE2.
+     * Defaults to 0.
+     * @param distance the prefetch distance in pixels, \c 0 disables prefetching. Maximum 64.
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Parameter out of range
+     */
+    virtual std::int32_t set_prefetch_distance(std::uint32_t distance) = 0;
+
+    /**
+     * Returns the prefetch distance.
+     */
+    virtual std::uint32_t get_prefetch_distance() const = 0;
+
+    /**
+     * The output frame is written once and not read again so for frames larger than the
+     * last level cache regular stores needlessly evict the source image from the cache.
+     * Output frames of at least \p threshold bytes are written with non-temporal streaming
+     * stores that bypass the cache. Only has an effect when built with SSE2, reflecting
+     * edges, for 4 byte pixels and when each row of the output frame is 16 byte aligned.
+     * Defaults to 16MB.
+     * @param threshold the frame size in bytes, \c 0 disables streaming stores.
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_streaming_threshold(std::uint32_t threshold) = 0;
+
+    /**
+     * Returns the streaming store threshold.
+     */
+    virtual std::uint32_t get_streaming_threshold() const = 0;
+
     /**
      * Visualises the currently configured segmentation. The pure green segment is the 
      * source segment.
@@ -271,6 +664,148 @@ public:
         return std::unique_ptr<IKaleidoscope>(create(width, height, component_size, num_components, stride));
     }
 
+    /**
+     * Sets the maximum number of threads processing at once across every instance in the
+     * process. Instances processing concurrently share these threads fairly, rather than
+     * each using every core and oversubscribing the machine.
+     * Defaults to 0.
+     * @param threading the total number of threads, including the thread calling #process.
+     * \c 0, use the number of hardware threads.
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    static std::int32_t set_global_threading(std::uint32_t threading);
+
+    /**
+     * Returns the maximum number of threads processing at once across every instance.
+     */
+    static std::uint32_t get_global_threading();
+
+    /**
+     * Sets how the process wide processing threads are placed on cores. With Affinity::NUMA
+     * each node is dealt a contiguous band of every frame which its threads process before
+     * helping other nodes, use #first_touch to place frame memory on the node that processes it.
+     * Pinning is only supported on Linux, elsewhere threads are never pinned.
+     * Defaults to Affinity::NONE.
+     * @param affinity the thread placement
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    static std::int32_t set_global_affinity(Affinity affinity);
+
+    /**
+     * Returns how the process wide processing threads are placed on cores.
+     */
+    static Affinity get_global_affinity();
+
+    /**
+     * Loads the process wide tuning profile, replacing any loaded before. The profile holds
+     * the best thread count and tile size for each resolution, pixel size, segmentation and
+     * mode and is used by instances with threading set to \c 0. It can be generated with
+     * <tt>kperf -T</tt>. The profile named by the \c KALEIDOSCOPE_TUNING_PROFILE environment
+     * variable is loaded at startup.
+     * The file has one entry per line of <tt>width height pixel_size segmentation mode threads tile_size</tt>
+     * where mode is \c reflect or \c background. Blank lines and lines starting with \c # are
+     * ignored and later entries replace earlier ones. The nearest segmentation is used when
+     * there is no exact match.
+     * @param path the profile to load
+     * @return
+     *          -  0: Success
+     *          - -1: Error (the file could not be read)
+     *          - -2: Invalid parameter (a malformed entry)
+     */
+    static std::int32_t load_tuning_profile(const char* path);
+
+    /**
+     * Sets the memory budget of the process wide cache of remap tables. Instances with the
+     * same resolution, pixel layout and mapping settings share one table from the cache,
+     * the least recently used tables are dropped when the cache grows over the budget.
+     * Dropped tables are freed once no instance uses them. Defaults to 64MB.
+     * @param bytes the budget in bytes, \c 0 to disable sharing
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    static std::int32_t set_mapping_cache_budget(std::uint64_t bytes);
+
+    /**
+     * Returns the memory budget of the process wide cache of remap tables in bytes.
+     */
+    static std::uint64_t get_mapping_cache_budget();
+
+    /**
+     * Sets the directory remap tables are cached in on disk. Tables are written there when
+     * built and later processes map them read only instead of building them again, sharing
+     * the pages between processes. The files are named by a hash of the frame geometry and
+     * mapping settings and hold a versioned header, files written by other versions or
+     * architectures are ignored. Failures to read or write the cache are not reported, the
+     * table is built in memory instead. The directory named by the
+     * \c KALEIDOSCOPE_MAPPING_CACHE environment variable is used by default.
+     * @param path the directory, which must exist, or \c nullptr to disable the disk cache
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    static std::int32_t set_mapping_cache_directory(const char* path);
+
+    /**
+     * Returns the directory remap tables are cached in on disk.
+     * @param path receives the directory as a nul terminated string, empty if the disk cache
+     *             is disabled, may be \c nullptr
+     * @param size the number of characters \p path can hold
+     * @return the number of characters needed to hold the directory including the terminator
+     */
+    static std::uint32_t get_mapping_cache_directory(char* path, std::uint32_t size);
+
+    /**
+     * Applies the kaleidoscope effect of each of \p count instances, the views, to the same
+     * input frame, scheduling the tiles of every view on the process wide threads as a single
+     * job. The tiles are numbered tile by tile so the views of a tile are rendered together
+     * while its part of the input is in cache. Views with the same origin and neither a remap
+     * table nor a proxy factor share the screen position and angle of each pixel, calculating
+     * them once rather than once per view. Each view is processed with its own settings and
+     * remap table at full quality, without the frame deadline, mirror padding or the source
+     * and output caches. The thread count and tile size are those of the first view.
+     * @param views the \p count instances to render, all created with the same frame geometry
+     * @param in_frame the input frame to process
+     * @param out_frames the \p count frames to receive the output image of each view
+     * @param count the number of views
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr, the frame geometry of the views differs, an
+     *                output frame is the input frame or too many tiles)
+     */
+    static std::int32_t process_views(IKaleidoscope* const* views, const void* in_frame, void* const* out_frames, std::uint32_t count);
+
+    /**
+     * Applies the kaleidoscope effect of each of \p count instances, the layers, to the same
+     * input frame and writes their weighted sum to \p out_frame in a single pass, for
+     * crossfades between settings and layered looks. Each output pixel is evaluated for every
+     * layer and its components blended as <tt>sum(weights[i] * layer_i)</tt>, rounded and
+     * clamped to 0-255, before being stored once. Weights summing to 1 give a blend. Where
+     * a layer without edge reflection or a background colour leaves a pixel unwritten it
+     * contributes the pixel already in \p out_frame. Each layer is processed with its own
+     * settings and remap table at full quality, without the proxy factor, frame deadline,
+     * mirror padding or the source and output caches. The thread count and tile size are
+     * those of the first layer.
+     * @param layers the \p count instances to blend, all created with the same frame geometry
+     *               and 8 bit components
+     * @param weights the \p count weights of the layers
+     * @param in_frame the input frame to process
+     * @param out_frame receives the blended output image
+     * @param count the number of layers
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr, the frame geometry of the layers differs,
+     *                components wider than 8 bits, more than 256 components or \p out_frame
+     *                is \p in_frame)
+     */
+    static std::int32_t process_blended(IKaleidoscope* const* layers, const float* weights, const void* in_frame, void* out_frame, std::uint32_t count);
+
 private:
     static IKaleidoscope* create(std::uint32_t width, std::uint32_t height, std::uint32_t component_size, std::uint32_t num_components, std::uint32_t stride = 0);
 
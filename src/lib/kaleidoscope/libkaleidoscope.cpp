@@ -3,7 +3,11 @@
 #include "libkaleidoscope.h"
 #include <memory>
 #include <cstring>
-#include <future>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
 
 #ifdef USE_SSE2
 #include "sse_mathfun_extension.h"
@@ -52,6 +56,77 @@ void default_delete<libkaleidoscope::IKaleidoscope>::operator()(libkaleidoscope:
 
 namespace libkaleidoscope {
 
+std::int32_t IKaleidoscope::set_global_threading(std::uint32_t threading)
+{
+    if (threading == 0) {
+        threading = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    Thread_pool::instance().resize(threading - 1);
+    return 0;
+}
+
+std::uint32_t IKaleidoscope::get_global_threading()
+{
+    return Thread_pool::instance().size() + 1;
+}
+
+std::int32_t IKaleidoscope::set_global_affinity(Affinity affinity)
+{
+    Thread_pool::instance().set_affinity(affinity);
+    return 0;
+}
+
+IKaleidoscope::Affinity IKaleidoscope::get_global_affinity()
+{
+    return Thread_pool::instance().get_affinity();
+}
+
+std::int32_t IKaleidoscope::process_views(IKaleidoscope* const* views, const void* in_frame, void* const* out_frames, std::uint32_t count)
+{
+    return Kaleidoscope::render_views(views, in_frame, out_frames, count);
+}
+
+std::int32_t IKaleidoscope::process_blended(IKaleidoscope* const* layers, const float* weights, const void* in_frame, void* out_frame, std::uint32_t count)
+{
+    return Kaleidoscope::render_blended(layers, weights, in_frame, out_frame, count);
+}
+
+std::int32_t IKaleidoscope::load_tuning_profile(const char* path)
+{
+    if (path == nullptr) {
+        return -2;
+    }
+    return Tuning_profile::instance().load(path);
+}
+
+std::int32_t IKaleidoscope::set_mapping_cache_budget(std::uint64_t bytes)
+{
+    Mapping_cache::instance().set_budget(static_cast<std::size_t>(std::min<std::uint64_t>(bytes, SIZE_MAX)));
+    return 0;
+}
+
+std::uint64_t IKaleidoscope::get_mapping_cache_budget()
+{
+    return Mapping_cache::instance().get_budget();
+}
+
+std::int32_t IKaleidoscope::set_mapping_cache_directory(const char* path)
+{
+    Mapping_cache::instance().set_directory(path ? path : "");
+    return 0;
+}
+
+std::uint32_t IKaleidoscope::get_mapping_cache_directory(char* path, std::uint32_t size)
+{
+    std::string directory(Mapping_cache::instance().get_directory());
+    if (path && size) {
+        std::size_t n = std::min<std::size_t>(directory.size(), size - 1);
+        std::memcpy(path, directory.data(), n);
+        path[n] = '\0';
+    }
+    return static_cast<std::uint32_t>(directory.size() + 1);
+}
+
 IKaleidoscope *IKaleidoscope::create(std::uint32_t width, std::uint32_t height, std::uint32_t component_size, std::uint32_t num_components, std::uint32_t stride)
 {
     return new Kaleidoscope(width, height, component_size, num_components, stride);
@@ -65,22 +140,14 @@ m_num_components(num_components),
 m_stride(stride ? stride : width * component_size * num_components),
 m_pixel_size(component_size * num_components),
 m_aspect(width/static_cast<float>(height)),
-m_origin_x(0.5f),
-m_origin_y(0.5f),
-m_origin_native_x(m_origin_x * width),
-m_origin_native_y(m_origin_y * height),
-m_segmentation(16),
-m_segment_direction(Direction::NONE),
-m_preferred_corner(Corner::BR),
-m_preferred_search_dir(Direction::CLOCKWISE),
-m_edge_reflect(true),
-m_background_colour(nullptr),
-m_edge_threshold(0),
-m_source_segment_angle(-1),
-m_n_segments(0),
-m_start_angle(0),
-m_segment_width(0),
-m_n_threads(0)
+m_mapping_version(0),
+m_frame_quality(Quality::FULL),
+m_remap_build_time(0),
+m_frame_stale(false),
+m_output_hits(0),
+m_output_misses(0),
+m_builder_stop(false),
+m_next_ticket(1)
 {
 #ifdef USE_SSE2
     m_sse_width = _mm_set1_ps(static_cast<float>(m_width));
@@ -94,32 +161,154 @@ m_n_threads(0)
     m_sse_epi32_2 = _mm_set1_epi32(2);
     m_sse_shift_1 = _mm_cvtsi32_si128(1);
 #endif
+    std::shared_ptr<State> state(new State());
+    state->origin_x = 0.5f;
+    state->origin_y = 0.5f;
+    state->segmentation = 16;
+    state->segment_direction = Direction::NONE;
+    state->preferred_corner = Corner::BR;
+    state->preferred_search_dir = Direction::CLOCKWISE;
+    state->edge_reflect = true;
+    state->background_colour = nullptr;
+    state->edge_threshold = 0;
+    state->source_segment_angle = -1;
+    state->n_threads = 0;
+    state->tile_size = 64;
+    state->prefetch_distance = 0;
+    state->streaming_threshold = 16 * 1024 * 1024;
+    state->auto_tuning = false;
+    state->remap_table = false;
+    state->frame_deadline = 0;
+    state->proxy_factor = 1;
+    state->remap_rebuild = Remap_rebuild::BLOCKING;
+    state->source_cache = false;
+    state->output_cache = 0;
+    state->mirror_padding = false;
+    state->mapping_version = 0;
+    init(state.get());
+    m_state = state;
 }
 
-std::int32_t Kaleidoscope::set_origin(float x, float y)
+std::shared_ptr<const Kaleidoscope::State> Kaleidoscope::state() const
 {
-    if (x < 0 || y < 0 || x > 1 || y > 1) {
-        return -2;
+    return std::atomic_load(&m_state);
+}
+
+std::uint32_t Kaleidoscope::stale_values(const State& from, const State& to)
+{
+    std::uint32_t stale(0);
+    // the start angle is only searched for when no source segment is given
+    bool search = to.source_segment_angle < 0;
+    if (from.origin_x != to.origin_x || from.origin_y != to.origin_y) {
+        stale |= stale_origin | (search ? stale_start_angle : 0);
+    }
+    if (from.segmentation != to.segmentation) {
+        stale |= stale_segments | stale_start_angle;
     }
-    m_origin_x = x;
-    m_origin_y = y;
+    if (search && (from.segment_direction != to.segment_direction ||
+                   from.preferred_corner != to.preferred_corner ||
+                   from.preferred_search_dir != to.preferred_search_dir)) {
+        stale |= stale_start_angle;
+    }
+    if (from.source_segment_angle != to.source_segment_angle && !(search && from.source_segment_angle < 0)) {
+        stale |= stale_start_angle;
+    }
+    if (stale ||
+        from.edge_reflect != to.edge_reflect ||
+        (!to.edge_reflect && from.edge_threshold != to.edge_threshold)) {
+        stale |= stale_mapping;
+    }
+    if (stale ||
+        from.segment_direction != to.segment_direction ||
+        from.preferred_corner != to.preferred_corner ||
+        from.preferred_search_dir != to.preferred_search_dir ||
+        from.source_segment_angle != to.source_segment_angle ||
+        from.background_colour != to.background_colour ||
+        from.edge_threshold != to.edge_threshold ||
+        from.n_threads != to.n_threads ||
+        from.tile_size != to.tile_size ||
+        from.prefetch_distance != to.prefetch_distance ||
+        from.streaming_threshold != to.streaming_threshold ||
+        from.auto_tuning != to.auto_tuning ||
+        from.remap_table != to.remap_table ||
+        from.frame_deadline != to.frame_deadline ||
+        from.proxy_factor != to.proxy_factor ||
+        from.remap_rebuild != to.remap_rebuild ||
+        from.source_cache != to.source_cache ||
+        from.output_cache != to.output_cache ||
+        from.mirror_padding != to.mirror_padding) {
+        stale |= stale_settings;
+    }
+    return stale;
+}
 
-    m_origin_native_x = m_origin_x * m_width;
-    m_origin_native_y = m_origin_y * m_height;
+template<typename Change>
+void Kaleidoscope::update(Change change)
+{
+    std::shared_ptr<const State> published;
+    {
+        // frames in progress keep the snapshot they started with
+        std::lock_guard<std::mutex> lock(m_state_mutex);
+        std::shared_ptr<const State> current(std::atomic_load(&m_state));
+        State state(*current);
+        change(&state);
+        std::uint32_t stale = stale_values(*current, state);
+        if (!stale) {
+            // setting a value it already has keeps the snapshot and everything built from it
+            return;
+        }
+        if (stale & stale_mapping) {
+            state.mapping_version = ++m_mapping_version;
+        }
+        init(&state, stale);
+        published.reset(new State(state));
+        std::atomic_store(&m_state, published);
+    }
+    // start rebuilding in the background now rather than when the next frame needs the table
+    if (published->remap_table && published->remap_rebuild != Remap_rebuild::BLOCKING &&
+        static_cast<std::size_t>(m_stride) * m_height < table_no_source) {
+        std::shared_ptr<const Remap_table> table(std::atomic_load(&m_remap));
+        if (!table || table->state->mapping_version != published->mapping_version) {
+            request_remap_table(published);
+        }
+    }
+}
 
-    m_n_segments = 0;
+Kaleidoscope::~Kaleidoscope()
+{
+    while (!m_in_flight.empty()) {
+        wait(m_in_flight.front()->ticket);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_builder_mutex);
+        m_builder_stop = true;
+    }
+    m_builder_wake.notify_one();
+    if (m_builder.joinable()) {
+        m_builder.join();
+    }
+}
 
+std::int32_t Kaleidoscope::set_origin(float x, float y)
+{
+    if (x < 0 || y < 0 || x > 1 || y > 1) {
+        return -2;
+    }
+    update([x, y](State* state) {
+        state->origin_x = x;
+        state->origin_y = y;
+    });
     return 0;
 }
 
 float Kaleidoscope::get_origin_x() const
 {
-    return m_origin_x;
+    return state()->origin_x;
 }
 
 float Kaleidoscope::get_origin_y() const
 {
-    return m_origin_y;
+    return state()->origin_y;
 }
 
 std::int32_t Kaleidoscope::set_segmentation(std::uint32_t segmentation)
@@ -127,38 +316,35 @@ std::int32_t Kaleidoscope::set_segmentation(std::uint32_t segmentation)
     if (segmentation == 0) {
         return -2;
     }
-    m_segmentation = segmentation;
-    m_n_segments = 0;
-
+    update([segmentation](State* state) { state->segmentation = segmentation; });
     return 0;
 }
 
 std::uint32_t Kaleidoscope::get_segmentation() const
 {
-    return m_segmentation;
+    return state()->segmentation;
 }
 
 std::int32_t Kaleidoscope::set_edge_threshold(std::uint32_t threshold)
 {
-    m_edge_threshold = threshold;
+    update([threshold](State* state) { state->edge_threshold = threshold; });
     return 0;
 }
 
 std::uint32_t Kaleidoscope::get_edge_threshold() const
 {
-    return m_edge_threshold;
+    return state()->edge_threshold;
 }
 
 std::int32_t Kaleidoscope::set_preferred_corner(Corner corner)
 {
-    m_preferred_corner = corner;
-    m_n_segments = 0;
+    update([corner](State* state) { state->preferred_corner = corner; });
     return 0;
 }
 
 Kaleidoscope::Corner Kaleidoscope::get_preferred_corner() const
 {
-    return m_preferred_corner;
+    return state()->preferred_corner;
 }
 
 std::int32_t Kaleidoscope::set_preferred_corner_search_direction(Direction direction)
@@ -166,47 +352,46 @@ std::int32_t Kaleidoscope::set_preferred_corner_search_direction(Direction direc
     if (direction == Direction::NONE) {
         return -2;
     }
-    m_preferred_search_dir = direction;
-    m_n_segments = 0;
+    update([direction](State* state) { state->preferred_search_dir = direction; });
     return 0;
 }
 
 Kaleidoscope::Direction Kaleidoscope::get_preferred_corner_search_direction() const
 {
-    return m_preferred_search_dir;
+    return state()->preferred_search_dir;
 }
 
 std::int32_t Kaleidoscope::set_reflect_edges(bool reflect)
 {
-    m_edge_reflect = reflect;
+    update([reflect](State* state) { state->edge_reflect = reflect; });
     return 0;
 }
 
 bool Kaleidoscope::get_reflect_edges() const
 {
-    return m_edge_reflect;
+    return state()->edge_reflect;
 }
 
 std::int32_t Kaleidoscope::set_background_colour(void* colour)
 {
-    m_background_colour = colour;
+    update([colour](State* state) { state->background_colour = colour; });
     return 0;
 }
 
 void* Kaleidoscope::get_background_colour() const
 {
-    return m_background_colour;
+    return state()->background_colour;
 }
 
 std::int32_t Kaleidoscope::set_source_segment(float angle)
 {
-    m_source_segment_angle = angle;
+    update([angle](State* state) { state->source_segment_angle = angle; });
     return 0;
 }
 
 float Kaleidoscope::get_source_segment() const
 {
-    return m_source_segment_angle;
+    return state()->source_segment_angle;
 }
 
 static double distance_sq(double x1, double y1, double x2, double y2)
@@ -220,12 +405,33 @@ std::int32_t inc_idx(std::int32_t start_idx, std::int32_t inc, std::int32_t max)
     return (start_idx < 0) ? max - 1 : start_idx % max;
 }
 
-void Kaleidoscope::init()
+void Kaleidoscope::init(State* state, std::uint32_t stale) const
 {
-    m_n_segments = m_segmentation * 2;
-    m_segment_width = MF_PI * 2 / m_n_segments;
-    
-    if (m_source_segment_angle < 0) {
+    state->output_key = output_key(*state);
+    if (stale & stale_origin) {
+        state->origin_native_x = state->origin_x * m_width;
+        state->origin_native_y = state->origin_y * m_height;
+#ifdef USE_SSE2
+        state->sse_origin_native_x = _mm_set1_ps(state->origin_x * m_width);
+        state->sse_origin_native_y = _mm_set1_ps(state->origin_y * m_height);
+#endif
+    }
+    if (stale & stale_segments) {
+        state->n_segments = state->segmentation * 2;
+        state->segment_width = MF_PI * 2 / state->n_segments;
+#ifdef USE_SSE2
+        state->sse_segment_width = _mm_set1_ps(state->segment_width);
+        state->sse_half_segment_width = _mm_set1_ps(state->segment_width/2);
+#endif
+    }
+    if (!(stale & stale_start_angle)) {
+        if (stale & stale_mapping) {
+            init_reach(state);
+        }
+        return;
+    }
+
+    if (state->source_segment_angle < 0) {
         // find origin rotation
         std::uint32_t corners[4][2] = {
             { 0, 0 },
@@ -234,16 +440,16 @@ void Kaleidoscope::init()
             { 0, 1 }
         };
         std::int32_t start_idx(0);
-        switch (m_preferred_corner) {
+        switch (state->preferred_corner) {
         case Corner::TL: start_idx = 0; break;
         case Corner::TR: start_idx = 1; break;
         case Corner::BR: start_idx = 2; break;
         case Corner::BL: start_idx = 3; break;
         }
-        std::int32_t dir = m_preferred_search_dir == Direction::CLOCKWISE ? 1 : -1;
+        std::int32_t dir = state->preferred_search_dir == Direction::CLOCKWISE ? 1 : -1;
         std::uint32_t idx = start_idx;
-        float origin_x = m_origin_x;
-        float origin_y = m_origin_y;
+        float origin_x = state->origin_x;
+        float origin_y = state->origin_y;
         double dist = distance_sq(origin_x, origin_y, corners[idx][0], corners[idx][1]);
         std::int32_t corner = idx;
         idx = inc_idx(idx, dir, 4);
@@ -258,77 +464,139 @@ void Kaleidoscope::init()
 
         float start_line_x = corners[corner][0] - origin_x;
         float start_line_y = corners[corner][1] - origin_y;
-        m_start_angle = std::atan2(start_line_y, start_line_x) - (m_segment_direction == Direction::NONE ?
+        state->start_angle = std::atan2(start_line_y, start_line_x) - (state->segment_direction == Direction::NONE ?
                                                                     0 :
-                                                                    (m_segment_width / (m_segment_direction == Direction::CLOCKWISE ? -2 : 2)));
+                                                                    (state->segment_width / (state->segment_direction == Direction::CLOCKWISE ? -2 : 2)));
     } else {
-        m_start_angle = -m_source_segment_angle;
+        state->start_angle = -state->source_segment_angle;
+    }
+#ifdef USE_SSE2
+    state->sse_start_angle = _mm_set1_ps(state->start_angle);
+#endif
+    init_reach(state);
+}
+
+void Kaleidoscope::init_reach(State* state) const
+{
+    // every pixel maps into the source segment, a sector about the start angle reaching out
+    // to the furthest corner, so the padding need only cover the bounding box of the sector
+    float radius = 0;
+    for (std::uint32_t corner = 0; corner < 4; ++corner) {
+        float dx = (corner & 1 ? m_width : 0) - state->origin_native_x;
+        float dy = ((corner & 2 ? m_height : 0) - state->origin_native_y) * m_aspect;
+        radius = std::max(radius, std::sqrt(dx * dx + dy * dy));
+    }
+    // widened for the error of the fast trigonometric functions
+    const float margin = 0.01f;
+    float first = state->start_angle - state->segment_width / 2 - margin;
+    float sweep = state->segment_width + 2 * margin;
+    float min_x = std::min(0.0f, std::min(std::cos(first), std::cos(first + sweep)));
+    float max_x = std::max(0.0f, std::max(std::cos(first), std::cos(first + sweep)));
+    float min_y = std::min(0.0f, std::min(std::sin(first), std::sin(first + sweep)));
+    float max_y = std::max(0.0f, std::max(std::sin(first), std::sin(first + sweep)));
+    // the sector reaches the full radius along any axis it spans
+    for (std::uint32_t axis = 0; axis < 4; ++axis) {
+        float from_first = std::fmod(axis * MF_PI / 2 - first, MF_PI * 2);
+        if (from_first < 0) {
+            from_first += MF_PI * 2;
+        }
+        if (from_first <= sweep) {
+            min_x = axis == 2 ? -1.0f : min_x;
+            max_x = axis == 0 ? 1.0f : max_x;
+            min_y = axis == 3 ? -1.0f : min_y;
+            max_y = axis == 1 ? 1.0f : max_y;
+        }
     }
+    float left = state->origin_native_x + min_x * radius;
+    float right = state->origin_native_x + max_x * radius;
+    float top = state->origin_native_y + min_y * radius / m_aspect;
+    float bottom = state->origin_native_y + max_y * radius / m_aspect;
+    // a couple of pixels more for rounding
+    state->pad_left = std::max(0, static_cast<std::int32_t>(std::ceil(-left)) + 2);
+    state->pad_right = std::max(0, static_cast<std::int32_t>(std::ceil(right - m_width)) + 2);
+    state->pad_top = std::max(0, static_cast<std::int32_t>(std::ceil(-top)) + 2);
+    state->pad_bottom = std::max(0, static_cast<std::int32_t>(std::ceil(bottom - m_height)) + 2);
+    source_range(state->edge_reflect, left, right, m_width, &state->footprint_x, &state->footprint_width);
+    source_range(state->edge_reflect, top, bottom, m_height, &state->footprint_y, &state->footprint_height);
 #ifdef USE_SSE2
-    m_sse_origin_native_x = _mm_set1_ps(m_origin_x * m_width);
-    m_sse_origin_native_y = _mm_set1_ps(m_origin_y * m_height);
-    m_sse_start_angle = _mm_set1_ps(m_start_angle);
-    m_sse_segment_width = _mm_set1_ps(m_segment_width);
-    m_sse_half_segment_width = _mm_set1_ps(m_segment_width/2);
+    state->sse_pad_min_x = _mm_set1_ps(static_cast<float>(-state->pad_left));
+    state->sse_pad_max_x = _mm_set1_ps(static_cast<float>(static_cast<std::int32_t>(m_width) + state->pad_right - 1));
+    state->sse_pad_min_y = _mm_set1_ps(static_cast<float>(-state->pad_top));
+    state->sse_pad_max_y = _mm_set1_ps(static_cast<float>(static_cast<std::int32_t>(m_height) + state->pad_bottom - 1));
 #endif
 }
 
 #ifdef USE_SSE2
-Kaleidoscope::Reflect_info Kaleidoscope::calculate_reflect_info(__m128i* x, __m128i* y)
+Kaleidoscope::Reflect_info Kaleidoscope::calculate_reflect_info(const State& state, __m128i* x, __m128i* y)
+{
+    __m128 screen_x;
+    __m128 screen_y;
+    to_screen(state, &screen_x, &screen_y, x, y);
+    return calculate_reflect_info(state, screen_x, screen_y, _mm_call_atan2_ps(screen_y, screen_x));
+}
+
+Kaleidoscope::Reflect_info Kaleidoscope::calculate_reflect_info(const State& state, __m128 screen_x, __m128 screen_y, __m128 polar_angle)
 {
     Reflect_info info;
 
-    to_screen(&info.screen_x, &info.screen_y, x, y);
+    info.screen_x = screen_x;
+    info.screen_y = screen_y;
 
     // info.angle = std::atan2(info.screen_y, info.screen_x) - m_start_angle;
     // info.reference_angle = std::fabs(info.angle) + m_segment_width / 2;
     // info.segment_number = std::uint32_t(info.reference_angle / m_segment_width);
 
-    info.angle = _mm_sub_ps(_mm_call_atan2_ps(info.screen_y, info.screen_x), m_sse_start_angle);
-    info.reference_angle = _mm_add_ps(_mm_and_ps(info.angle, *(v4sf*)_ps_inv_sign_mask), m_sse_half_segment_width);
+    // atan2_ps returns nan for atan2(0,0), zero it so that the origin maps to itself as with std::atan2
+    polar_angle = _mm_and_ps(polar_angle, _mm_cmpord_ps(polar_angle, polar_angle));
+    info.angle = _mm_sub_ps(polar_angle, state.sse_start_angle);
+    info.reference_angle = _mm_add_ps(_mm_and_ps(info.angle, *(v4sf*)_ps_inv_sign_mask), state.sse_half_segment_width);
     // we do a max with 0 since atan2_ps will return nan for atan2(0,0) which ends up with a negative reference angle.
     //info.segment_number = _mm_max_ps(_mm_div_ps(info.reference_angle, m_sse_segment_width), m_sse_ps_0);
-    info.segment_number_i = _mm_cvttps_epi32(_mm_max_ps(_mm_div_ps(info.reference_angle, m_sse_segment_width), m_sse_ps_0));
+    info.segment_number_i = _mm_cvttps_epi32(_mm_max_ps(_mm_div_ps(info.reference_angle, state.sse_segment_width), m_sse_ps_0));
     info.segment_number = _mm_cvtepi32_ps(info.segment_number_i);
     
     return info;
 }
 
-void Kaleidoscope::to_screen(__m128* x, __m128* y, __m128i* sx, __m128i* sy)
+void Kaleidoscope::to_screen(const State& state, __m128* x, __m128* y, __m128i* sx, __m128i* sy)
 {
-    // x = sx - m_origin_native_x;
+    // x = sx - origin_native_x;
     *x = _mm_cvtepi32_ps(*sx);
-    *x = _mm_sub_ps(*x, m_sse_origin_native_x);
-    // y = (sy - m_origin_native_y) * m_aspect;
+    *x = _mm_sub_ps(*x, state.sse_origin_native_x);
+    // y = (sy - origin_native_y) * m_aspect;
     *y = _mm_cvtepi32_ps(*sy);
-    *y = _mm_sub_ps(*y, m_sse_origin_native_y);
+    *y = _mm_sub_ps(*y, state.sse_origin_native_y);
     *y = _mm_mul_ps(*y, m_sse_aspect);
 }
 
-void Kaleidoscope::from_screen(__m128* x, __m128* y)
+void Kaleidoscope::from_screen(const State& state, __m128* x, __m128* y)
 {
-    //x += m_origin_native_x;
-    *x = _mm_add_ps(*x, m_sse_origin_native_x);
-    // y = y / m_aspect + m_origin_native_y;
+    //x += origin_native_x;
+    *x = _mm_add_ps(*x, state.sse_origin_native_x);
+    // y = y / m_aspect + origin_native_y;
     *y = _mm_div_ps(*y, m_sse_aspect);
-    *y = _mm_add_ps(*y, m_sse_origin_native_y);
+    *y = _mm_add_ps(*y, state.sse_origin_native_y);
 }
 
-void Kaleidoscope::rotate(int x, int y, __m128 *source_x, __m128 *source_y)
+void Kaleidoscope::rotate(const State& state, int x, int y, __m128 *source_x, __m128 *source_y, int step, __m128i* region)
 {
-    ALIGN16_BEG int ALIGN16_END mx[4] = { x, x + 1, x + 2, x + 3 };
+    ALIGN16_BEG int ALIGN16_END mx[4] = { x, x + step, x + 2 * step, x + 3 * step };
     ALIGN16_BEG int ALIGN16_END my[4] = { y, y, y, y };
 
-    Reflect_info info = calculate_reflect_info((__m128i*)mx, (__m128i*)my);
+    Reflect_info info = calculate_reflect_info(state, (__m128i*)mx, (__m128i*)my);
+    rotate(state, info, source_x, source_y, region);
+}
 
-    // float reflection_angle = (info.segment_number * m_segment_width);
-    __m128 reflection_angle = _mm_mul_ps(info.segment_number, m_sse_segment_width);
+void Kaleidoscope::rotate(const State& state, const Reflect_info& info, __m128 *source_x, __m128 *source_y, __m128i* region)
+{
+    // float reflection_angle = (info.segment_number * segment_width);
+    __m128 reflection_angle = _mm_mul_ps(info.segment_number, state.sse_segment_width);
 
-    //reflection_angle -= info.segment_number % 2 ? (m_segment_width - 2 * (info.reference_angle - reflection_angle)) : 0;
+    //reflection_angle -= info.segment_number % 2 ? (segment_width - 2 * (info.reference_angle - reflection_angle)) : 0;
     __m128i segi_p1 = _mm_add_epi32(info.segment_number_i, m_sse_epi32_1);
     __m128 refl_factor = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srl_epi32(segi_p1, m_sse_shift_1), _mm_srl_epi32(info.segment_number_i, m_sse_shift_1)));
 
-    reflection_angle = _mm_sub_ps(reflection_angle, _mm_mul_ps(refl_factor, _mm_sub_ps(m_sse_segment_width, _mm_mul_ps(m_sse_ps_2, _mm_sub_ps(info.reference_angle, reflection_angle)))));
+    reflection_angle = _mm_sub_ps(reflection_angle, _mm_mul_ps(refl_factor, _mm_sub_ps(state.sse_segment_width, _mm_mul_ps(m_sse_ps_2, _mm_sub_ps(info.reference_angle, reflection_angle)))));
 
     // reflection_angle *= std::signbit(info.angle) ? 1 : -1;
     reflection_angle = _mm_mul_ps(reflection_angle, _mm_sub_ps(m_sse_ps_0, _mm_or_ps(_mm_and_ps(info.angle, *(v4sf*)_ps_sign_mask), m_sse_ps_1)));
@@ -343,32 +611,39 @@ void Kaleidoscope::rotate(int x, int y, __m128 *source_x, __m128 *source_y)
     //float source_y = info.screen_y * cos_angle + info.screen_x * sin_angle;
     *source_y = _mm_add_ps(_mm_mul_ps(info.screen_y, cos_angle), _mm_mul_ps(info.screen_x, sin_angle));
 
-    from_screen(source_x, source_y);
+    from_screen(state, source_x, source_y);
+
+    if (region) {
+        // region = segment_number * 2 + (segment_number && std::signbit(info.angle) ? 1 : 0)
+        __m128i sign = _mm_srli_epi32(_mm_castps_si128(info.angle), 31);
+        sign = _mm_and_si128(sign, _mm_cmpgt_epi32(info.segment_number_i, _mm_setzero_si128()));
+        *region = _mm_add_epi32(_mm_slli_epi32(info.segment_number_i, 1), sign);
+    }
 }
 
 #else
-Kaleidoscope::Reflect_info Kaleidoscope::calculate_reflect_info(std::uint32_t x, std::uint32_t y)
+Kaleidoscope::Reflect_info Kaleidoscope::calculate_reflect_info(const State& state, std::uint32_t x, std::uint32_t y)
 {
     Reflect_info info;
 
-    to_screen(info.screen_x, info.screen_y, x, y);
+    to_screen(state, info.screen_x, info.screen_y, x, y);
 
-    info.angle = std::atan2(info.screen_y, info.screen_x) - m_start_angle;
-    info.reference_angle = std::fabs(info.angle) + m_segment_width / 2;
-    info.segment_number = std::uint32_t(info.reference_angle / m_segment_width);
+    info.angle = std::atan2(info.screen_y, info.screen_x) - state.start_angle;
+    info.reference_angle = std::fabs(info.angle) + state.segment_width / 2;
+    info.segment_number = std::uint32_t(info.reference_angle / state.segment_width);
 
     return info;
 }
-void Kaleidoscope::to_screen(float& x, float& y, std::uint32_t sx, std::uint32_t sy)
+void Kaleidoscope::to_screen(const State& state, float& x, float& y, std::uint32_t sx, std::uint32_t sy)
 {
-    x = sx - m_origin_native_x;
-    y = (sy - m_origin_native_y) * m_aspect;
+    x = sx - state.origin_native_x;
+    y = (sy - state.origin_native_y) * m_aspect;
 }
 
-void Kaleidoscope::from_screen(float& x, float& y)
+void Kaleidoscope::from_screen(const State& state, float& x, float& y)
 {
-    x += m_origin_native_x;
-    y = y / m_aspect + m_origin_native_y;
+    x += state.origin_native_x;
+    y = y / m_aspect + state.origin_native_y;
 }
 #endif
 
@@ -382,135 +657,624 @@ std::uint8_t* Kaleidoscope::lookup(std::uint8_t* p, std::uint32_t x, std::uint32
     return p + m_stride * static_cast<std::size_t>(y) + m_pixel_size * static_cast<std::size_t>(x);
 }
 
-void Kaleidoscope::process_bg(float x, float y, const std::uint8_t* in, std::uint8_t* out)
+std::size_t Kaleidoscope::offset(std::uint32_t x, std::uint32_t y) const
+{
+    return m_stride * static_cast<std::size_t>(y) + m_pixel_size * static_cast<std::size_t>(x);
+}
+
+std::uint8_t* Kaleidoscope::output(const Block& block, std::uint32_t x, std::uint32_t y) const
+{
+    return block.out_frame + (offset(x, y) - block.out_offset);
+}
+
+std::size_t Kaleidoscope::input_offset(const Block& block, std::uint32_t x, std::uint32_t y) const
+{
+    if (!block.footprint) {
+        return offset(x, y);
+    }
+    return block.in_stride * static_cast<std::size_t>(y - block.in_y) + m_pixel_size * static_cast<std::size_t>(x - block.in_x);
+}
+
+void Kaleidoscope::copy_pixel(const State& state, const std::uint8_t* in, std::size_t offset, std::uint8_t* out)
+{
+    if (offset != no_source) {
+        std::memcpy(out, in + offset, m_pixel_size);
+    }
+    else if (state.background_colour) {
+        std::memcpy(out, reinterpret_cast<const std::uint8_t*>(state.background_colour), m_pixel_size);
+    }
+}
+
+std::size_t Kaleidoscope::bg_offset(const State& state, const Block& block, float x, float y)
 {
-    if (x < 0 && -x <= m_edge_threshold) {
+    if (x < 0 && -x <= state.edge_threshold) {
         x = 0;
     }
-    else if (x >= m_width && x < m_width + m_edge_threshold) {
+    else if (x >= m_width && x < m_width + state.edge_threshold) {
         x = m_width - 1.0f;
     }
-    if (y < 0 && -y <= m_edge_threshold) {
+    if (y < 0 && -y <= state.edge_threshold) {
         y = 0;
     }
-    else if (y >= m_height && y < m_height + m_edge_threshold) {
+    else if (y >= m_height && y < m_height + state.edge_threshold) {
         y = m_height - 1.0f;
     }
     if (static_cast<std::uint32_t>(x) >= 0 && static_cast<std::uint32_t>(x) < m_width &&
         static_cast<std::uint32_t>(y) >= 0 && static_cast<std::uint32_t>(y) < m_height) {
-        std::memcpy(out, lookup(in, static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y)), m_pixel_size);
+        return input_offset(block, static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y));
     }
-    else if (m_background_colour) {
-        std::memcpy(out, reinterpret_cast<const std::uint8_t*>(m_background_colour), m_pixel_size);
+    return no_source;
+}
+
+void Kaleidoscope::process_bg(const State& state, const Block& block, float x, float y, std::uint8_t* out)
+{
+    copy_pixel(state, block.in_frame, bg_offset(state, block, x, y), out);
+}
+
+void Kaleidoscope::dispatch(Block* block)
+{
+    if (block->step > 1 || block->refine) {
+        process_block_reduced(block);
+        return;
+    }
+    if (block->proxy > 1) {
+        process_block_proxy(block);
+        return;
+    }
+    if (block->table) {
+        process_block_table(block);
+        return;
     }
+#ifdef USE_SSE2
+    if (block->state->edge_reflect) {
+        process_block(block);
+    } else {
+        process_block_bg(block);
+    }
+#else
+    process_block(block);
+#endif
 }
 
+void Kaleidoscope::process_block_reduced(Block* block)
+{
+    const State& state = *block->state;
+    const std::uint32_t step = block->step;
+    // when refining, the blocks on the grid of the coarser pass already hold their pixel
+    const std::uint32_t coarse = block->refine ? step * 2 : 0;
+    // the grid is anchored to the frame so that neighbouring tiles, and passes, agree
+    const std::uint32_t grid_x = block->x_start - block->x_start % step;
+    const std::uint32_t grid_y = block->y_start - block->y_start % step;
+    for (std::uint32_t gy = grid_y; gy <= block->y_end; gy += step) {
+        std::uint32_t y = std::max(gy, block->y_start);
+        std::uint32_t y_end = std::min(gy + step - 1, block->y_end);
+        std::uint32_t gx = grid_x;
+        std::uint32_t stride = step;
+        if (coarse && gy % coarse == 0) {
+            // only every other block on the row is new
+            gx += grid_x % coarse == 0 ? step : 0;
+            stride = coarse;
+        }
+        // evaluate the top left pixel of four blocks at a time
+        for (std::uint32_t x = gx; x <= block->x_end; x += 4 * stride) {
 #ifdef USE_SSE2
-void Kaleidoscope::process_block(Block* block)
+            std::size_t offsets[4];
+            source_offsets(state, *block, x, gy, offsets, stride);
+#endif
+            for (std::uint32_t i = 0; i < 4 && x + i * stride <= block->x_end; ++i) {
+                std::uint32_t bx = x + i * stride;
+#ifdef USE_SSE2
+                std::size_t source = offsets[i];
+#else
+                std::size_t source = source_offset(state, *block, bx, gy);
+#endif
+                std::uint32_t x_end = std::min(bx + step - 1, block->x_end);
+                std::uint8_t* out = output(*block, std::max(bx, block->x_start), y);
+                for (std::uint32_t c = std::max(bx, block->x_start); c <= x_end; ++c, out += m_pixel_size) {
+                    copy_pixel(state, block->in_frame, source, out);
+                }
+            }
+        }
+        // the rest of the rows of the blocks repeat the first
+        const std::uint8_t* first = output(*block, block->x_start, y);
+        std::size_t width = static_cast<std::size_t>(block->x_end - block->x_start + 1) * m_pixel_size;
+        for (std::uint32_t r = y + 1; r <= y_end; ++r) {
+            std::memcpy(output(*block, block->x_start, r), first, width);
+        }
+    }
+}
+
+void Kaleidoscope::evaluate_grid_row(const State& state, std::uint32_t x, std::uint32_t y, std::uint32_t step, std::uint32_t n, Grid_row* row)
 {
-    for (std::int32_t y = block->y_start; y <= static_cast<std::int32_t>(block->y_end); ++y) {
-        for (std::int32_t x = block->x_start; x <= static_cast<std::int32_t>(block->x_end); x += 4) {
-            std::uint8_t* out = lookup(block->out_frame, x, y);
-            __m128 source_x;
-            __m128 source_y;
+#ifdef USE_SSE2
+    for (std::uint32_t i = 0; i < n; i += 4) {
+        __m128 source_x;
+        __m128 source_y;
+        __m128i region;
+        rotate(state, x + i * step, y, &source_x, &source_y, step, &region);
+        _mm_storeu_ps(row->x + i, source_x);
+        _mm_storeu_ps(row->y + i, source_y);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row->region + i), region);
+    }
+#else
+    for (std::uint32_t i = 0; i < n; ++i) {
+        row->region[i] = rotate(state, x + i * step, y, row->x[i], row->y[i]);
+    }
+#endif
+}
 
-            // rotate points to source_x,source_y
-            rotate(x, y, &source_x, &source_y);
+void Kaleidoscope::process_block_proxy(Block* block)
+{
+    const State& state = *block->state;
+    const std::uint32_t step = block->proxy;
+    // the grid is anchored to the frame so that neighbouring tiles agree
+    const std::uint32_t grid_x = block->x_start - block->x_start % step;
+    const std::uint32_t grid_y = block->y_start - block->y_start % step;
+    Grid_row rows[2];
+    float left_x[proxy_strip];
+    float left_y[proxy_strip];
+    float dx[proxy_strip];
+    float dy[proxy_strip];
+    bool seam[proxy_strip];
+    for (std::uint32_t gx = grid_x; gx <= block->x_end; gx += proxy_strip * step) {
+        std::uint32_t n_cells = std::min(static_cast<std::uint32_t>(proxy_strip), (block->x_end - gx) / step + 1);
+        std::uint32_t x_start = std::max(gx, block->x_start);
+        std::uint32_t x_end = std::min(gx + n_cells * step - 1, block->x_end);
+        Grid_row* top = &rows[0];
+        Grid_row* bottom = &rows[1];
+        evaluate_grid_row(state, gx, grid_y, step, n_cells + 1, top);
+        for (std::uint32_t gy = grid_y; gy <= block->y_end; gy += step) {
+            evaluate_grid_row(state, gx, gy + step, step, n_cells + 1, bottom);
+            for (std::uint32_t i = 0; i < n_cells; ++i) {
+                std::int32_t region = top->region[i];
+                seam[i] = top->region[i + 1] != region || bottom->region[i] != region || bottom->region[i + 1] != region;
+            }
+            std::uint32_t y_end = std::min(gy + step - 1, block->y_end);
+            for (std::uint32_t y = std::max(gy, block->y_start); y <= y_end; ++y) {
+                float v = static_cast<float>(y - gy) / step;
+                for (std::uint32_t i = 0; i < n_cells; ++i) {
+                    left_x[i] = top->x[i] + (bottom->x[i] - top->x[i]) * v;
+                    left_y[i] = top->y[i] + (bottom->y[i] - top->y[i]) * v;
+                    dx[i] = (top->x[i + 1] + (bottom->x[i + 1] - top->x[i + 1]) * v - left_x[i]) / step;
+                    dy[i] = (top->y[i + 1] + (bottom->y[i + 1] - top->y[i + 1]) * v - left_y[i]) / step;
+                }
+                process_proxy_row(block, gx, x_start, x_end, y, left_x, left_y, dx, dy, seam);
+            }
+            std::swap(top, bottom);
+        }
+    }
+}
+
+void Kaleidoscope::process_proxy_row(Block* block, std::uint32_t grid_x, std::uint32_t x_start, std::uint32_t x_end, std::uint32_t y,
+    const float* left_x, const float* left_y, const float* dx, const float* dy, const bool* seam)
+{
+    const State& state = *block->state;
+    const std::uint32_t step = block->proxy;
+    std::uint8_t* out = output(*block, x_start, y);
+    // source coordinates are interpolated from the left of each cell rather than accumulated
+    // so they don't depend on where the block starts
+#ifdef USE_SSE2
+    // the proxy factor is a power of 2
+    const std::uint32_t shift = step == 2 ? 1 : step == 4 ? 2 : 3;
+    const __m128 ramp = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    for (std::uint32_t x = x_start; x <= x_end; x += 4, out += 4 * m_pixel_size) {
+        // the four pixels are in one cell, or two for a factor of 2
+        std::uint32_t first = (x - grid_x) >> shift;
+        std::uint32_t last = (x + 3 - grid_x) >> shift;
+        if (seam[first] || seam[last]) {
+            // the mapping changes within the cells so evaluate every pixel
+            std::size_t offsets[4];
+            source_offsets(state, *block, x, y, offsets);
+            for (std::uint32_t j = 0; j < 4; ++j) {
+                copy_pixel(state, block->in_frame, offsets[j], out + j * m_pixel_size);
+            }
+            continue;
+        }
+        __m128 source_x;
+        __m128 source_y;
+        if (first == last) {
+            __m128 u = _mm_add_ps(_mm_set1_ps(static_cast<float>(x - grid_x - (first << shift))), ramp);
+            source_x = _mm_add_ps(_mm_set1_ps(left_x[first]), _mm_mul_ps(_mm_set1_ps(dx[first]), u));
+            source_y = _mm_add_ps(_mm_set1_ps(left_y[first]), _mm_mul_ps(_mm_set1_ps(dy[first]), u));
+        } else {
+            __m128 u = _mm_setr_ps(0.0f, 1.0f, 0.0f, 1.0f);
+            source_x = _mm_add_ps(_mm_setr_ps(left_x[first], left_x[first], left_x[last], left_x[last]),
+                                  _mm_mul_ps(_mm_setr_ps(dx[first], dx[first], dx[last], dx[last]), u));
+            source_y = _mm_add_ps(_mm_setr_ps(left_y[first], left_y[first], left_y[last], left_y[last]),
+                                  _mm_mul_ps(_mm_setr_ps(dy[first], dy[first], dy[last], dy[last]), u));
+        }
+        if (state.edge_reflect) {
+            __m128i source_xi;
+            __m128i source_yi;
+            reflect_coords(source_x, source_y, &source_xi, &source_yi);
+            if (block->footprint) {
+                footprint_coords(*block, &source_xi, &source_yi);
+            }
+            gather(block->in_frame, block->footprint ? block->in_stride : m_stride, &source_xi, &source_yi, out);
+        } else {
+            float* sx = reinterpret_cast<float*>(&source_x);
+            float* sy = reinterpret_cast<float*>(&source_y);
+            for (std::uint32_t j = 0; j < 4; ++j) {
+                process_bg(state, *block, sx[j], sy[j], out + j * m_pixel_size);
+            }
+        }
+    }
+#else
+    for (std::uint32_t x = x_start; x <= x_end; ++x, out += m_pixel_size) {
+        std::uint32_t c = (x - grid_x) / step;
+        float u = static_cast<float>(x - grid_x - c * step);
+        std::size_t source = seam[c] ? source_offset(state, *block, x, y) : reflect_offset(state, *block, left_x[c] + dx[c] * u, left_y[c] + dy[c] * u);
+        copy_pixel(state, block->in_frame, source, out);
+    }
+#endif
+}
+
+void Kaleidoscope::process_block_table(Block* block)
+{
+    const State& state = *block->state;
+    std::uint32_t width = block->x_end - block->x_start + 1;
+    for (std::uint32_t y = block->y_start; y <= block->y_end; ++y) {
+        const std::uint32_t* offsets = block->table + static_cast<std::size_t>(y) * m_width + block->x_start;
+        std::uint8_t* out = output(*block, block->x_start, y);
+#ifdef USE_SSE2
+        if (block->stream) {
+            // streaming is only used for 4 byte pixels without a background, see use_streaming_stores
+            for (std::uint32_t x = 0; x < width; x += 4, out += 16) {
+                if (state.prefetch_distance && x + state.prefetch_distance < width) {
+                    _mm_prefetch(reinterpret_cast<const char*>(block->in_frame + offsets[x + state.prefetch_distance]), _MM_HINT_T0);
+                }
+                ALIGN16_BEG std::int32_t ALIGN16_END pixels[4];
+                std::memcpy(&pixels[0], block->in_frame + offsets[x], 4);
+                std::memcpy(&pixels[1], block->in_frame + offsets[x + 1], 4);
+                std::memcpy(&pixels[2], block->in_frame + offsets[x + 2], 4);
+                std::memcpy(&pixels[3], block->in_frame + offsets[x + 3], 4);
+                _mm_stream_si128(reinterpret_cast<__m128i*>(out), _mm_load_si128(reinterpret_cast<__m128i*>(pixels)));
+            }
+            continue;
+        }
+#endif
+        for (std::uint32_t x = 0; x < width; ++x, out += m_pixel_size) {
+#ifdef USE_SSE2
+            if (state.prefetch_distance && x + state.prefetch_distance < width && offsets[x + state.prefetch_distance] != table_no_source) {
+                _mm_prefetch(reinterpret_cast<const char*>(block->in_frame + offsets[x + state.prefetch_distance]), _MM_HINT_T0);
+            }
+#endif
+            copy_pixel(state, block->in_frame, offsets[x] == table_no_source ? no_source : offsets[x], out);
+        }
+    }
+#ifdef USE_SSE2
+    if (block->stream) {
+        _mm_sfence();
+    }
+#endif
+}
 
-            // reflect back into image if necessary
+#ifdef USE_SSE2
+void Kaleidoscope::source_coords(const State& state, int x, int y, __m128i* source_xi, __m128i* source_yi, int step)
+{
+    __m128 source_x;
+    __m128 source_y;
 
-            // if (source_x < 0) source_x = -source_x;
-            source_x = _mm_and_ps(source_x, *(v4sf*)_ps_inv_sign_mask);
-            // if (source_x > m_width) source_x = m_width - (source_x - m_width);
-            __m128 ge_width = _mm_cmpge_ps(source_x, m_sse_width);
-            source_x = _mm_or_ps(_mm_and_ps(_mm_sub_ps(m_sse_width, _mm_sub_ps(source_x, m_sse_width)), ge_width), _mm_andnot_ps(ge_width, source_x));
+    // rotate points to source_x,source_y
+    rotate(state, x, y, &source_x, &source_y, step);
+
+    reflect_coords(source_x, source_y, source_xi, source_yi);
+}
 
-            // same for y
-            source_y = _mm_and_ps(source_y, *(v4sf*)_ps_inv_sign_mask);
-            __m128 ge_height = _mm_cmpge_ps(source_y, m_sse_height);
-            source_y = _mm_or_ps(_mm_and_ps(_mm_sub_ps(m_sse_height, _mm_sub_ps(source_y, m_sse_height)), ge_height), _mm_andnot_ps(ge_height,source_y));
+void Kaleidoscope::reflect_coords(__m128 source_x, __m128 source_y, __m128i* source_xi, __m128i* source_yi)
+{
+    // reflect back into image if necessary
 
-            __m128i source_xi = _mm_cvttps_epi32(_mm_min_ps(source_x, _mm_sub_ps(m_sse_width, m_sse_ps_1)));
-            __m128i source_yi = _mm_cvttps_epi32(_mm_min_ps(source_y, _mm_sub_ps(m_sse_height, m_sse_ps_1)));
+    // if (source_x < 0) source_x = -source_x;
+    source_x = _mm_and_ps(source_x, *(v4sf*)_ps_inv_sign_mask);
+    // if (source_x > m_width) source_x = m_width - (source_x - m_width);
+    __m128 ge_width = _mm_cmpge_ps(source_x, m_sse_width);
+    source_x = _mm_or_ps(_mm_and_ps(_mm_sub_ps(m_sse_width, _mm_sub_ps(source_x, m_sse_width)), ge_width), _mm_andnot_ps(ge_width, source_x));
 
-            std::int32_t* sx = reinterpret_cast<std::int32_t*>(&source_xi);
-            std::int32_t* sy = reinterpret_cast<std::int32_t*>(&source_yi);
-            std::memcpy(out, lookup(block->in_frame, sx[0], sy[0]), m_pixel_size);
-            out += m_pixel_size;
-            std::memcpy(out, lookup(block->in_frame, sx[1], sy[1]), m_pixel_size);
-            out += m_pixel_size;
-            std::memcpy(out, lookup(block->in_frame, sx[2], sy[2]), m_pixel_size);
-            out += m_pixel_size;
-            std::memcpy(out, lookup(block->in_frame, sx[3], sy[3]), m_pixel_size);
+    // same for y
+    source_y = _mm_and_ps(source_y, *(v4sf*)_ps_inv_sign_mask);
+    __m128 ge_height = _mm_cmpge_ps(source_y, m_sse_height);
+    source_y = _mm_or_ps(_mm_and_ps(_mm_sub_ps(m_sse_height, _mm_sub_ps(source_y, m_sse_height)), ge_height), _mm_andnot_ps(ge_height,source_y));
+
+    *source_xi = _mm_cvttps_epi32(_mm_min_ps(source_x, _mm_sub_ps(m_sse_width, m_sse_ps_1)));
+    *source_yi = _mm_cvttps_epi32(_mm_min_ps(source_y, _mm_sub_ps(m_sse_height, m_sse_ps_1)));
+}
+
+void Kaleidoscope::block_coords(const Block& block, int x, int y, __m128i* source_xi, __m128i* source_yi)
+{
+    const State& state = *block.state;
+    if (!block.padded) {
+        source_coords(state, x, y, source_xi, source_yi);
+        if (block.footprint) {
+            footprint_coords(block, source_xi, source_yi);
+        }
+        return;
+    }
+    __m128 source_x;
+    __m128 source_y;
+    rotate(state, x, y, &source_x, &source_y);
+
+    // the padding reaches every source coordinate, clamping only guards the memory outside it
+    // (max first so that nan becomes the minimum)
+    *source_xi = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(source_x, state.sse_pad_min_x), state.sse_pad_max_x));
+    *source_yi = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(source_y, state.sse_pad_min_y), state.sse_pad_max_y));
+}
+
+void Kaleidoscope::footprint_coords(const Block& block, __m128i* source_xi, __m128i* source_yi)
+{
+    *source_xi = _mm_sub_epi32(*source_xi, _mm_set1_epi32(static_cast<std::int32_t>(block.in_x)));
+    *source_yi = _mm_sub_epi32(*source_yi, _mm_set1_epi32(static_cast<std::int32_t>(block.in_y)));
+}
+
+const std::uint8_t* Kaleidoscope::source_pixel(const std::uint8_t* in, std::size_t stride, std::int32_t x, std::int32_t y) const
+{
+    return in + static_cast<std::ptrdiff_t>(y) * static_cast<std::ptrdiff_t>(stride) + static_cast<std::ptrdiff_t>(x) * m_pixel_size;
+}
+
+void Kaleidoscope::source_offsets(const State& state, const Block& block, int x, int y, std::size_t* offsets, int step)
+{
+    if (state.edge_reflect) {
+        __m128i source_xi;
+        __m128i source_yi;
+        source_coords(state, x, y, &source_xi, &source_yi, step);
+        std::int32_t* sx = reinterpret_cast<std::int32_t*>(&source_xi);
+        std::int32_t* sy = reinterpret_cast<std::int32_t*>(&source_yi);
+        for (int i = 0; i < 4; ++i) {
+            offsets[i] = input_offset(block, sx[i], sy[i]);
+        }
+    } else {
+        __m128 source_x;
+        __m128 source_y;
+        rotate(state, x, y, &source_x, &source_y, step);
+        float* sx = reinterpret_cast<float*>(&source_x);
+        float* sy = reinterpret_cast<float*>(&source_y);
+        for (int i = 0; i < 4; ++i) {
+            offsets[i] = bg_offset(state, block, sx[i], sy[i]);
+        }
+    }
+}
+
+void Kaleidoscope::prefetch(const std::uint8_t* in, std::size_t stride, __m128i* source_xi, __m128i* source_yi)
+{
+    std::int32_t* sx = reinterpret_cast<std::int32_t*>(source_xi);
+    std::int32_t* sy = reinterpret_cast<std::int32_t*>(source_yi);
+    _mm_prefetch(reinterpret_cast<const char*>(source_pixel(in, stride, sx[0], sy[0])), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char*>(source_pixel(in, stride, sx[1], sy[1])), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char*>(source_pixel(in, stride, sx[2], sy[2])), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char*>(source_pixel(in, stride, sx[3], sy[3])), _MM_HINT_T0);
+}
+
+void Kaleidoscope::gather(const std::uint8_t* in, std::size_t stride, __m128i* source_xi, __m128i* source_yi, std::uint8_t* out)
+{
+    std::int32_t* sx = reinterpret_cast<std::int32_t*>(source_xi);
+    std::int32_t* sy = reinterpret_cast<std::int32_t*>(source_yi);
+    std::memcpy(out, source_pixel(in, stride, sx[0], sy[0]), m_pixel_size);
+    out += m_pixel_size;
+    std::memcpy(out, source_pixel(in, stride, sx[1], sy[1]), m_pixel_size);
+    out += m_pixel_size;
+    std::memcpy(out, source_pixel(in, stride, sx[2], sy[2]), m_pixel_size);
+    out += m_pixel_size;
+    std::memcpy(out, source_pixel(in, stride, sx[3], sy[3]), m_pixel_size);
+}
+
+void Kaleidoscope::gather_stream(const std::uint8_t* in, std::size_t stride, __m128i* source_xi, __m128i* source_yi, std::uint8_t* out)
+{
+    std::int32_t* sx = reinterpret_cast<std::int32_t*>(source_xi);
+    std::int32_t* sy = reinterpret_cast<std::int32_t*>(source_yi);
+    ALIGN16_BEG std::int32_t ALIGN16_END pixels[4];
+    std::memcpy(&pixels[0], source_pixel(in, stride, sx[0], sy[0]), 4);
+    std::memcpy(&pixels[1], source_pixel(in, stride, sx[1], sy[1]), 4);
+    std::memcpy(&pixels[2], source_pixel(in, stride, sx[2], sy[2]), 4);
+    std::memcpy(&pixels[3], source_pixel(in, stride, sx[3], sy[3]), 4);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(out), _mm_load_si128(reinterpret_cast<__m128i*>(pixels)));
+}
+
+void Kaleidoscope::process_block(Block* block)
+{
+    const State& state = *block->state;
+    if (state.prefetch_distance) {
+        process_block_prefetch(block);
+        return;
+    }
+    const std::size_t stride = block->padded || block->footprint ? block->in_stride : m_stride;
+    for (std::int32_t y = block->y_start; y <= static_cast<std::int32_t>(block->y_end); ++y) {
+        for (std::int32_t x = block->x_start; x <= static_cast<std::int32_t>(block->x_end); x += 4) {
+            __m128i source_xi;
+            __m128i source_yi;
+
+            block_coords(*block, x, y, &source_xi, &source_yi);
+            if (block->stream) {
+                gather_stream(block->in_frame, stride, &source_xi, &source_yi, output(*block, x, y));
+            } else {
+                gather(block->in_frame, stride, &source_xi, &source_yi, output(*block, x, y));
+            }
+        }
+    }
+    if (block->stream) {
+        _mm_sfence();
+    }
+}
+
+void Kaleidoscope::process_block_prefetch(Block* block)
+{
+    // Source coordinates are calculated prefetch_distance pixels ahead of the gather
+    // and held in a ring until they are needed. The source lines they reference are
+    // prefetched when calculated so they are (hopefully) in cache by the time of the gather.
+    __m128i ring_x[max_prefetch_distance / 4];
+    __m128i ring_y[max_prefetch_distance / 4];
+    const State& state = *block->state;
+    const std::int32_t ahead = static_cast<std::int32_t>(state.prefetch_distance / 4);
+    const std::int32_t n_groups = static_cast<std::int32_t>(block->x_end - block->x_start + 1) / 4;
+    const std::int32_t primed = std::min(ahead, n_groups);
+    const std::size_t stride = block->padded || block->footprint ? block->in_stride : m_stride;
+
+    for (std::int32_t y = block->y_start; y <= static_cast<std::int32_t>(block->y_end); ++y) {
+        for (std::int32_t g = 0; g < primed; ++g) {
+            block_coords(*block, block->x_start + g * 4, y, &ring_x[g], &ring_y[g]);
+            prefetch(block->in_frame, stride, &ring_x[g], &ring_y[g]);
+        }
+        std::uint8_t* out = output(*block, block->x_start, y);
+        for (std::int32_t g = 0; g < n_groups; ++g) {
+            std::int32_t slot = g % ahead;
+            __m128i source_xi = ring_x[slot];
+            __m128i source_yi = ring_y[slot];
+            if (g + ahead < n_groups) {
+                block_coords(*block, block->x_start + (g + ahead) * 4, y, &ring_x[slot], &ring_y[slot]);
+                prefetch(block->in_frame, stride, &ring_x[slot], &ring_y[slot]);
+            }
+            if (block->stream) {
+                gather_stream(block->in_frame, stride, &source_xi, &source_yi, out);
+            } else {
+                gather(block->in_frame, stride, &source_xi, &source_yi, out);
+            }
+            out += m_pixel_size * 4;
         }
     }
+    if (block->stream) {
+        _mm_sfence();
+    }
 }
 
 void Kaleidoscope::process_block_bg(Block* block)
 {
+    const State& state = *block->state;
     for (std::int32_t y = block->y_start; y <= static_cast<std::int32_t>(block->y_end); ++y) {
         for (std::int32_t x = block->x_start; x <= static_cast<std::int32_t>(block->x_end); x += 4) {
-            std::uint8_t* out = lookup(block->out_frame, x, y);
+            std::uint8_t* out = output(*block, x, y);
             __m128 source_x;
             __m128 source_y;
 
             // rotate points to source_x,source_y
-            rotate(x, y, &source_x, &source_y);
+            rotate(state, x, y, &source_x, &source_y);
 
             float* sx = reinterpret_cast<float*>(&source_x);
             float* sy = reinterpret_cast<float*>(&source_y);
-            process_bg(sx[0], sy[0], block->in_frame, out);
+            process_bg(state, *block, sx[0], sy[0], out);
             out += m_pixel_size;
-            process_bg(sx[1], sy[1], block->in_frame, out);
+            process_bg(state, *block, sx[1], sy[1], out);
             out += m_pixel_size;
-            process_bg(sx[2], sy[2], block->in_frame, out);
+            process_bg(state, *block, sx[2], sy[2], out);
             out += m_pixel_size;
-            process_bg(sx[3], sy[3], block->in_frame, out);
+            process_bg(state, *block, sx[3], sy[3], out);
         }
     }
 }
 
-
-#else
-void Kaleidoscope::process_block(Block *block)
+void Kaleidoscope::process_block_views(const Block& block, const View* views, std::uint32_t count)
 {
-    for (std::uint32_t y = block->y_start; y <= block->y_end; ++y) {
-        for (std::uint32_t x = block->x_start; x <= block->x_end; ++x) {
-            std::uint8_t* out = lookup(block->out_frame, x, y);
-
-            Reflect_info info = calculate_reflect_info(x, y);
-
-            if (info.segment_number) {
-                float reflection_angle = (info.segment_number * m_segment_width);
-                reflection_angle -= info.segment_number % 2 ? (m_segment_width - 2 * (info.reference_angle - reflection_angle)) : 0;
-                
-                reflection_angle *= std::signbit(info.angle) ? 1 : -1;
-                float cos_angle = std::cos(reflection_angle);
-                float sin_angle = std::sin(reflection_angle);
-                float source_x = info.screen_x * cos_angle - info.screen_y * sin_angle;
-                float source_y = info.screen_y * cos_angle + info.screen_x * sin_angle;
-                
-                from_screen(source_x, source_y);
-
-                if (m_edge_reflect) {
-                    if (source_x < 0) {
-                        source_x = -source_x;
-                    } else if (source_x > m_width - 10e-4f) {
-                        source_x = m_width - (source_x - m_width + 10e-4f);
-                    } if (source_y < 0) {
-                        source_y = -source_y;
-                    } else if (source_y > m_height - 10e-4f) {
-                        source_y = m_height - (source_y - m_height + 10e-4f);
+    // the polar coordinates of a run of pixels are calculated once, then each view renders the run
+    const std::int32_t run = 64;
+    __m128 screen_x[run / 4];
+    __m128 screen_y[run / 4];
+    __m128 polar_angle[run / 4];
+    const State& origin = *views[0].state;
+    bool stream = false;
+
+    for (std::int32_t y = block.y_start; y <= static_cast<std::int32_t>(block.y_end); ++y) {
+        for (std::int32_t x_run = block.x_start; x_run <= static_cast<std::int32_t>(block.x_end); x_run += run) {
+            const std::int32_t n_groups = (std::min(x_run + run - 1, static_cast<std::int32_t>(block.x_end)) - x_run + 1) / 4;
+            for (std::int32_t g = 0; g < n_groups; ++g) {
+                std::int32_t x = x_run + g * 4;
+                ALIGN16_BEG int ALIGN16_END mx[4] = { x, x + 1, x + 2, x + 3 };
+                ALIGN16_BEG int ALIGN16_END my[4] = { y, y, y, y };
+                to_screen(origin, &screen_x[g], &screen_y[g], (__m128i*)mx, (__m128i*)my);
+                polar_angle[g] = _mm_call_atan2_ps(screen_y[g], screen_x[g]);
+            }
+            for (std::uint32_t v = 0; v < count; ++v) {
+                const State& state = *views[v].state;
+                std::uint8_t* out = lookup(views[v].out_frame, x_run, y);
+                for (std::int32_t g = 0; g < n_groups; ++g, out += m_pixel_size * 4) {
+                    Reflect_info info = calculate_reflect_info(state, screen_x[g], screen_y[g], polar_angle[g]);
+                    __m128 source_x;
+                    __m128 source_y;
+                    rotate(state, info, &source_x, &source_y);
+                    if (state.edge_reflect) {
+                        __m128i source_xi;
+                        __m128i source_yi;
+                        reflect_coords(source_x, source_y, &source_xi, &source_yi);
+                        if (views[v].stream) {
+                            gather_stream(block.in_frame, m_stride, &source_xi, &source_yi, out);
+                        } else {
+                            gather(block.in_frame, m_stride, &source_xi, &source_yi, out);
+                        }
+                        continue;
                     }
-                    std::memcpy(out, lookup(block->in_frame, static_cast<std::uint32_t>(source_x), static_cast<std::uint32_t>(source_y)), m_pixel_size);
-                } else {
-                    process_bg(source_x, source_y, block->in_frame, out);
+                    float* sx = reinterpret_cast<float*>(&source_x);
+                    float* sy = reinterpret_cast<float*>(&source_y);
+                    process_bg(state, block, sx[0], sy[0], out);
+                    process_bg(state, block, sx[1], sy[1], out + m_pixel_size);
+                    process_bg(state, block, sx[2], sy[2], out + m_pixel_size * 2);
+                    process_bg(state, block, sx[3], sy[3], out + m_pixel_size * 3);
                 }
-            } else {
-                std::memcpy(out, lookup(block->in_frame, x, y), m_pixel_size);
+                stream = stream || views[v].stream;
             }
         }
     }
+    if (stream) {
+        _mm_sfence();
+    }
+}
+
+
+#else
+std::int32_t Kaleidoscope::rotate(const State& state, std::uint32_t x, std::uint32_t y, float& source_x, float& source_y)
+{
+    Reflect_info info = calculate_reflect_info(state, x, y);
+
+    if (!info.segment_number) {
+        source_x = static_cast<float>(x);
+        source_y = static_cast<float>(y);
+        return 0;
+    }
+    float reflection_angle = (info.segment_number * state.segment_width);
+    reflection_angle -= info.segment_number % 2 ? (state.segment_width - 2 * (info.reference_angle - reflection_angle)) : 0;
+    
+    reflection_angle *= std::signbit(info.angle) ? 1 : -1;
+    float cos_angle = std::cos(reflection_angle);
+    float sin_angle = std::sin(reflection_angle);
+    source_x = info.screen_x * cos_angle - info.screen_y * sin_angle;
+    source_y = info.screen_y * cos_angle + info.screen_x * sin_angle;
+    
+    from_screen(state, source_x, source_y);
+    return static_cast<std::int32_t>(info.segment_number * 2) + (std::signbit(info.angle) ? 1 : 0);
+}
+
+std::size_t Kaleidoscope::source_offset(const State& state, const Block& block, std::uint32_t x, std::uint32_t y)
+{
+    float source_x;
+    float source_y;
+    if (!rotate(state, x, y, source_x, source_y)) {
+        return input_offset(block, x, y);
+    }
+    return reflect_offset(state, block, source_x, source_y);
+}
+
+std::size_t Kaleidoscope::reflect_offset(const State& state, const Block& block, float source_x, float source_y)
+{
+    if (!state.edge_reflect) {
+        return bg_offset(state, block, source_x, source_y);
+    }
+    if (source_x < 0) {
+        source_x = -source_x;
+    } else if (source_x > m_width - 10e-4f) {
+        source_x = m_width - (source_x - m_width + 10e-4f);
+    } if (source_y < 0) {
+        source_y = -source_y;
+    } else if (source_y > m_height - 10e-4f) {
+        source_y = m_height - (source_y - m_height + 10e-4f);
+    }
+    return input_offset(block, static_cast<std::uint32_t>(source_x), static_cast<std::uint32_t>(source_y));
+}
+
+void Kaleidoscope::process_block(Block *block)
+{
+    const State& state = *block->state;
+    for (std::uint32_t y = block->y_start; y <= block->y_end; ++y) {
+        std::uint8_t* out = output(*block, block->x_start, y);
+        for (std::uint32_t x = block->x_start; x <= block->x_end; ++x, out += m_pixel_size) {
+            copy_pixel(state, block->in_frame, source_offset(state, *block, x, y), out);
+        }
+    }
 }
 #endif
 
@@ -582,14 +1346,13 @@ std::uint8_t colours[63][3] = {
 
 std::int32_t Kaleidoscope::set_segment_direction(Direction direction)
 {
-    m_segment_direction = direction;
-    m_n_segments = 0;
+    update([direction](State* state) { state->segment_direction = direction; });
     return 0;
 }
 
 libkaleidoscope::Kaleidoscope::Direction Kaleidoscope::get_segment_direction() const
 {
-    return m_segment_direction;
+    return state()->segment_direction;
 }
 
 std::int32_t Kaleidoscope::process(const void* in_frame, void* out_frame)
@@ -602,65 +1365,1386 @@ std::int32_t Kaleidoscope::process(const void* in_frame, void* out_frame)
         return -2;
     }
 #endif
-    if (m_n_segments == 0) {
-        init();
+    std::shared_ptr<const State> state(this->state());
+    // the output is only a function of the input and settings with a background colour
+    bool cache = state->output_cache && (state->edge_reflect || state->background_colour);
+    std::uint64_t key[3] = {};
+    if (cache || (state->source_cache && state->remap_table)) {
+        fingerprint(reinterpret_cast<const std::uint8_t*>(in_frame), key);
+        key[2] = state->output_key;
+        if (cache && !state->edge_reflect) {
+            // the background colour is part of the output, cache is only set when there is one
+            std::uint64_t colour = 0;
+            std::memcpy(&colour, state->background_colour, std::min<std::size_t>(m_pixel_size, sizeof(colour)));
+            key[2] ^= (colour + 0x9E3779B97F4A7C15ull) * 0xC2B2AE3D27D4EB4Full;
+        }
+    }
+    if (cache) {
+        if (find_output(key, reinterpret_cast<std::uint8_t*>(out_frame))) {
+            ++m_output_hits;
+            m_frame_quality = Quality::FULL;
+            m_frame_stale = false;
+            return 0;
+        }
+        ++m_output_misses;
+    }
+    bool stream = use_streaming_stores(*state, out_frame);
+    Tuning tuning(this->tuning(*state, true));
+    auto frame_start = std::chrono::steady_clock::now();
+    // drop to a reduced quality when full quality is predicted to miss the deadline
+    std::uint32_t level = 0;
+    if (state->frame_deadline > 0) {
+        level = m_governor.next(cost_key(*state), state->frame_deadline);
+    }
+    std::uint32_t step = 1u << level;
+    // the remap table holds offsets into the whole frame, frames processed in place evaluate
+    // the effect to read the copy of the footprint
+    bool in_place = in_frame == out_frame;
+    std::shared_ptr<const Remap_table> table;
+    if (state->remap_table && step == 1 && state->proxy_factor == 1 && !in_place) {
+        table = remap_table(state, tuning);
+    }
+    bool pad = false;
+#ifdef USE_SSE2
+    pad = state->mirror_padding && state->edge_reflect && !table && step == 1 && state->proxy_factor == 1;
+#endif
+    std::vector<std::uint8_t> copy;
+    Tile_task task(this,
+        state,
+        reinterpret_cast<const std::uint8_t*>(in_frame),
+        reinterpret_cast<std::uint8_t*>(out_frame),
+        tuning.tile_size,
+        stream);
+    task.set_table(table);
+    if (table && state->source_cache) {
+        task.set_source(source_layout(reinterpret_cast<const std::uint8_t*>(in_frame), key, table));
+    }
+    task.set_step(step);
+    task.set_proxy(state->proxy_factor);
+    if (pad) {
+        std::size_t stride = static_cast<std::size_t>(m_width + state->pad_left + state->pad_right) * m_pixel_size;
+        copy = acquire_copy();
+        copy.resize(stride * (m_height + state->pad_top + state->pad_bottom));
+        pad_frame(*state, reinterpret_cast<const std::uint8_t*>(in_frame), copy.data(), stride, tuning.n_threads);
+        task.set_padded(copy.data() + stride * state->pad_top + static_cast<std::size_t>(state->pad_left) * m_pixel_size, stride);
+    } else if (in_place && state->footprint_width && state->footprint_height) {
+        // the output overwrites the input as it is written, so gather from a copy of the part that is read
+        copy = acquire_copy();
+        copy_footprint(*state, reinterpret_cast<const std::uint8_t*>(in_frame), &copy);
+        task.set_footprint(copy.data(), state->footprint_x, state->footprint_y, static_cast<std::size_t>(state->footprint_width) * m_pixel_size);
+    }
+    run_frame(&task, tuning.n_threads);
+    if (!copy.empty()) {
+        release_copy(std::move(copy));
+    }
+    m_frame_stale = table && table->state->mapping_version != state->mapping_version;
+    if (cache && step == 1 && !m_frame_stale) {
+        cache_output(key, reinterpret_cast<const std::uint8_t*>(out_frame), state->output_cache);
+    }
+    double frame_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count();
+    if (state->auto_tuning && state->n_threads == 0 && step == 1) {
+        m_tuner.record(tuning, frame_time);
+    }
+    if (state->frame_deadline > 0) {
+        m_governor.record(level, frame_time);
+    }
+    m_frame_quality = static_cast<Quality>(level);
+    
+    return 0;
+}
+
+void Kaleidoscope::run_frame(Tile_task* task, std::uint32_t n_threads)
+{
+    if (n_threads == 1) {
+        auto start = std::chrono::steady_clock::now();
+        Block block(task->frame());
+        dispatch(&block);
+        float busy = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(m_busy_mutex);
+        m_busy_times.assign(1, busy);
+    } else {
+        std::unique_ptr<Thread_pool::Job> job(acquire_job());
+        Thread_pool::instance().run(job.get(), task, task->size(), n_threads);
+        {
+            std::lock_guard<std::mutex> lock(m_busy_mutex);
+            m_busy_times.assign(job->busy_times().begin(), job->busy_times().end());
+        }
+        release_job(std::move(job));
+    }
+}
+
+std::int32_t Kaleidoscope::process_progressive(const void* in_frame, void* out_frame, std::uint32_t* block_size)
+{
+    if (in_frame == nullptr || out_frame == nullptr || block_size == nullptr || in_frame == out_frame) {
+        return -2;
+    }
+#ifdef USE_SSE2
+    if (m_width % 4 != 0) {
+        return -2;
+    }
+#endif
+    std::shared_ptr<const State> state(this->state());
+    std::lock_guard<std::mutex> lock(m_progress_mutex);
+    if (state != m_progress.state || in_frame != m_progress.in_frame || out_frame != m_progress.out_frame) {
+        // start again from the coarsest pass
+        m_progress.state = state;
+        m_progress.in_frame = in_frame;
+        m_progress.out_frame = out_frame;
+        m_progress.step = 0;
     }
-    if (m_n_threads == 1) {
-        Block block(reinterpret_cast<const std::uint8_t*>(in_frame),
+    if (m_progress.step != 1) {
+        std::uint32_t step = m_progress.step ? m_progress.step / 2 : progressive_step;
+        Tuning tuning(this->tuning(*state, false));
+        Tile_task task(this,
+            state,
+            reinterpret_cast<const std::uint8_t*>(in_frame),
             reinterpret_cast<std::uint8_t*>(out_frame),
-            0, 0,
-            m_width - 1, m_height - 1);
+            tuning.tile_size,
+            false);
+        task.set_step(step);
+        task.set_refine(m_progress.step != 0);
+        run_frame(&task, tuning.n_threads);
+        m_progress.step = step;
+    }
+    *block_size = m_progress.step;
+    return 0;
+}
+
+std::int32_t Kaleidoscope::cancel_progressive()
+{
+    std::lock_guard<std::mutex> lock(m_progress_mutex);
+    m_progress = Progress();
+    return 0;
+}
+
+std::int32_t Kaleidoscope::submit(const void* in_frame, void* out_frame, std::uint64_t* ticket)
+{
+    if (in_frame == nullptr || out_frame == nullptr || ticket == nullptr || in_frame == out_frame) {
+        return -2;
+    }
 #ifdef USE_SSE2
-        if (m_edge_reflect) {
-            process_block(&block);
-        } else {
-            process_block_bg(&block);
+    if (m_width % 4 != 0) {
+        return -2;
+    }
+#endif
+    std::shared_ptr<const State> state(this->state());
+    Tuning tuning(this->tuning(*state, false));
+    Tile_task task(this,
+        state,
+        reinterpret_cast<const std::uint8_t*>(in_frame),
+        reinterpret_cast<std::uint8_t*>(out_frame),
+        tuning.tile_size,
+        use_streaming_stores(*state, out_frame));
+    if (state->remap_table && state->proxy_factor == 1) {
+        task.set_table(remap_table(state, tuning));
+    }
+    task.set_proxy(state->proxy_factor);
+    // small frames are left to a single thread so that several are processed side by
+    // side, large ones are split between the threads
+    std::uint32_t n_threads = tuning.n_threads;
+    if (task.size() < n_threads * async_tiles_per_thread) {
+        n_threads = 1;
+    }
+
+    // completed frames are reused so that once warmed up submitting allocates nothing
+    std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+    std::unique_ptr<In_flight> frame;
+    if (m_free_frames.empty()) {
+        frame.reset(new In_flight(task));
+    } else {
+        frame = std::move(m_free_frames.back());
+        m_free_frames.pop_back();
+        frame->task = task;
+    }
+    frame->ticket = m_next_ticket++;
+    *ticket = frame->ticket;
+    In_flight* started = frame.get();
+    m_in_flight.push_back(std::move(frame));
+    Thread_pool::instance().start(&started->job, &started->task, started->task.size(), n_threads);
+    return 0;
+}
+
+std::int32_t Kaleidoscope::wait(std::uint64_t ticket)
+{
+    std::unique_ptr<In_flight> frame;
+    {
+        // only a few frames are ever in flight so a linear search is cheapest
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        auto it = std::find_if(m_in_flight.begin(), m_in_flight.end(),
+            [ticket](const std::unique_ptr<In_flight>& f) { return f->ticket == ticket; });
+        if (it == m_in_flight.end()) {
+            return -2;
+        }
+        frame = std::move(*it);
+        m_in_flight.erase(it);
+    }
+    Thread_pool::instance().wait(&frame->job);
+    // don't keep a replaced remap table alive while the frame waits for reuse
+    frame->task.set_table(nullptr);
+    std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+    m_free_frames.push_back(std::move(frame));
+    return 0;
+}
+
+std::int32_t Kaleidoscope::process_batch(const void* const* in_frames, void* const* out_frames, std::uint32_t count)
+{
+    if (in_frames == nullptr || out_frames == nullptr) {
+        return -2;
+    }
+    for (std::uint32_t i = 0; i < count; ++i) {
+        if (in_frames[i] == nullptr || out_frames[i] == nullptr) {
+            return -2;
+        }
+        // the tiles of every frame are processed together, an output may not be read or
+        // written by any other frame of the batch
+        for (std::uint32_t j = 0; j < count; ++j) {
+            if (out_frames[i] == in_frames[j] || (j < i && out_frames[i] == out_frames[j])) {
+                return -2;
+            }
+        }
+    }
+#ifdef USE_SSE2
+    if (m_width % 4 != 0) {
+        return -2;
+    }
+#endif
+    if (count == 0) {
+        return 0;
+    }
+    std::shared_ptr<const State> state(this->state());
+    Tuning tuning(this->tuning(*state, false));
+    bool stream = true;
+    for (std::uint32_t i = 0; i < count && stream; ++i) {
+        stream = use_streaming_stores(*state, out_frames[i]);
+    }
+    Batch_task task(this,
+        state,
+        reinterpret_cast<const std::uint8_t* const*>(in_frames),
+        reinterpret_cast<std::uint8_t* const*>(out_frames),
+        count,
+        tuning.tile_size,
+        stream);
+    // task indices are 32 bit
+    if (static_cast<std::uint64_t>(task.Tile_task::size()) * count > UINT32_MAX) {
+        return -2;
+    }
+    std::shared_ptr<const Remap_table> table;
+    if (state->remap_table && state->proxy_factor == 1) {
+        table = remap_table(state, tuning);
+    }
+    task.set_table(table);
+    task.set_proxy(state->proxy_factor);
+    if (tuning.n_threads == 1) {
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint32_t i = 0; i < count; ++i) {
+            Block frame(task.frame(i));
+            dispatch(&frame);
+        }
+        float busy = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(m_busy_mutex);
+        m_busy_times.assign(1, busy);
+    } else {
+        std::unique_ptr<Thread_pool::Job> job(acquire_job());
+        Thread_pool::instance().run(job.get(), &task, task.size(), tuning.n_threads);
+        {
+            std::lock_guard<std::mutex> lock(m_busy_mutex);
+            m_busy_times.assign(job->busy_times().begin(), job->busy_times().end());
+        }
+        release_job(std::move(job));
+    }
+    m_frame_stale = table && table->state->mapping_version != state->mapping_version;
+    m_frame_quality = Quality::FULL;
+    return 0;
+}
+
+std::int32_t Kaleidoscope::render_views(IKaleidoscope* const* views, const void* in_frame, void* const* out_frames, std::uint32_t count)
+{
+    if (views == nullptr || in_frame == nullptr || out_frames == nullptr) {
+        return -2;
+    }
+    for (std::uint32_t i = 0; i < count; ++i) {
+        if (views[i] == nullptr || out_frames[i] == nullptr || out_frames[i] == in_frame) {
+            return -2;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    Kaleidoscope* first = static_cast<Kaleidoscope*>(views[0]);
+    for (std::uint32_t i = 1; i < count; ++i) {
+        Kaleidoscope* view = static_cast<Kaleidoscope*>(views[i]);
+        if (view->m_width != first->m_width || view->m_height != first->m_height ||
+            view->m_pixel_size != first->m_pixel_size || view->m_stride != first->m_stride) {
+            return -2;
+        }
+    }
+#ifdef USE_SSE2
+    if (first->m_width % 4 != 0) {
+        return -2;
+    }
+#endif
+
+    std::vector<View> list(count);
+    for (std::uint32_t i = 0; i < count; ++i) {
+        View& view = list[i];
+        view.kaleidoscope = static_cast<Kaleidoscope*>(views[i]);
+        view.state = view.kaleidoscope->state();
+        view.out_frame = static_cast<std::uint8_t*>(out_frames[i]);
+        view.stream = view.kaleidoscope->use_streaming_stores(*view.state, out_frames[i]);
+        if (view.state->remap_table && view.state->proxy_factor == 1) {
+            view.table = view.kaleidoscope->remap_table(view.state, view.kaleidoscope->tuning(*view.state, false));
         }
+#ifdef USE_SSE2
+        view.shared = !view.table && view.state->proxy_factor == 1;
 #else
-        process_block(&block);
+        view.shared = false;
+#endif
+    }
+    // views sharing an origin are grouped together, the others are each a group of their own
+    std::stable_sort(list.begin(), list.end(), [](const View& a, const View& b) {
+        return std::make_tuple(a.shared, a.state->origin_native_x, a.state->origin_native_y) <
+            std::make_tuple(b.shared, b.state->origin_native_x, b.state->origin_native_y);
+    });
+    std::vector<std::uint32_t> groups;
+    groups.reserve(count + 1);
+    for (std::uint32_t i = 0; i < count; ++i) {
+        if (i == 0 || !list[i].shared || !list[i - 1].shared ||
+            list[i].state->origin_native_x != list[i - 1].state->origin_native_x ||
+            list[i].state->origin_native_y != list[i - 1].state->origin_native_y) {
+            groups.push_back(i);
+        }
+    }
+    std::uint32_t n_groups = static_cast<std::uint32_t>(groups.size());
+    groups.push_back(count);
+
+    Tuning tuning(first->tuning(*first->state(), false));
+    View_task task(first, static_cast<const std::uint8_t*>(in_frame), list.data(), groups.data(), n_groups, tuning.tile_size);
+    // task indices are 32 bit
+    if (static_cast<std::uint64_t>(task.Tile_task::size()) * n_groups > UINT32_MAX) {
+        return -2;
+    }
+    if (tuning.n_threads == 1) {
+        for (std::uint32_t group = 0; group < n_groups; ++group) {
+            task.process(task.frame(), group);
+        }
+    } else {
+        std::unique_ptr<Thread_pool::Job> job(first->acquire_job());
+        Thread_pool::instance().run(job.get(), &task, task.size(), tuning.n_threads);
+        first->release_job(std::move(job));
+    }
+    for (const View& view : list) {
+        view.kaleidoscope->m_frame_stale = view.table && view.table->state->mapping_version != view.state->mapping_version;
+        view.kaleidoscope->m_frame_quality = Quality::FULL;
+    }
+    return 0;
+}
+
+std::int32_t Kaleidoscope::render_blended(IKaleidoscope* const* layers, const float* weights, const void* in_frame, void* out_frame, std::uint32_t count)
+{
+    if (layers == nullptr || weights == nullptr || in_frame == nullptr || out_frame == nullptr || out_frame == in_frame) {
+        return -2;
+    }
+    for (std::uint32_t i = 0; i < count; ++i) {
+        if (layers[i] == nullptr) {
+            return -2;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    Kaleidoscope* first = static_cast<Kaleidoscope*>(layers[0]);
+    for (std::uint32_t i = 1; i < count; ++i) {
+        Kaleidoscope* layer = static_cast<Kaleidoscope*>(layers[i]);
+        if (layer->m_width != first->m_width || layer->m_height != first->m_height || layer->m_component_size != first->m_component_size ||
+            layer->m_pixel_size != first->m_pixel_size || layer->m_stride != first->m_stride) {
+            return -2;
+        }
+    }
+    // the layers all match the first, the samples of a run of at least 4 pixels must fit in blend_run_bytes
+    if (first->m_component_size != 1 || first->m_pixel_size > blend_run_bytes / 4) {
+        return -2;
+    }
+#ifdef USE_SSE2
+    if (first->m_width % 4 != 0) {
+        return -2;
+    }
 #endif
+
+    std::vector<Layer> list(count);
+    for (std::uint32_t i = 0; i < count; ++i) {
+        Layer& layer = list[i];
+        layer.kaleidoscope = static_cast<Kaleidoscope*>(layers[i]);
+        layer.state = layer.kaleidoscope->state();
+        if (layer.state->remap_table) {
+            layer.table = layer.kaleidoscope->remap_table(layer.state, layer.kaleidoscope->tuning(*layer.state, false));
+        }
+        layer.weight = weights[i];
+    }
+
+    Tuning tuning(first->tuning(*list[0].state, false));
+    Blend_task task(first, static_cast<const std::uint8_t*>(in_frame), static_cast<std::uint8_t*>(out_frame), list.data(), count, tuning.tile_size);
+    if (tuning.n_threads == 1) {
+        task.blend(task.frame());
     } else {
-        std::uint32_t n_threads = m_n_threads == 0 ? std::thread::hardware_concurrency() : m_n_threads;
+        std::unique_ptr<Thread_pool::Job> job(first->acquire_job());
+        Thread_pool::instance().run(job.get(), &task, task.size(), tuning.n_threads);
+        first->release_job(std::move(job));
+    }
+    for (const Layer& layer : list) {
+        layer.kaleidoscope->m_frame_stale = layer.table && layer.table->state->mapping_version != layer.state->mapping_version;
+        layer.kaleidoscope->m_frame_quality = Quality::FULL;
+    }
+    return 0;
+}
+
+std::unique_ptr<Thread_pool::Job> Kaleidoscope::acquire_job()
+{
+    std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+    std::unique_ptr<Thread_pool::Job> job;
+    if (m_free_jobs.empty()) {
+        job.reset(new Thread_pool::Job());
+    } else {
+        job = std::move(m_free_jobs.back());
+        m_free_jobs.pop_back();
+    }
+    return job;
+}
+
+void Kaleidoscope::release_job(std::unique_ptr<Thread_pool::Job> job)
+{
+    std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+    m_free_jobs.push_back(std::move(job));
+}
+
+std::vector<std::uint8_t> Kaleidoscope::acquire_copy()
+{
+    std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+    std::vector<std::uint8_t> copy;
+    if (!m_free_copies.empty()) {
+        copy = std::move(m_free_copies.back());
+        m_free_copies.pop_back();
+    }
+    return copy;
+}
+
+void Kaleidoscope::release_copy(std::vector<std::uint8_t> copy)
+{
+    std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+    m_free_copies.push_back(std::move(copy));
+}
+
+std::int32_t Kaleidoscope::mirror(std::int32_t v, std::int32_t size)
+{
+    // as reflect_coords, truncating towards zero: coordinates before the start reflect
+    // about the first pixel and those past the end about the edge after the last
+    while (v < 0 || v >= size) {
+        v = v < 0 ? -v : 2 * size - 1 - v;
+    }
+    return v;
+}
+
+void Kaleidoscope::source_range(bool reflect, float first, float last, std::int32_t size, std::uint32_t* start, std::uint32_t* length)
+{
+    // a pixel more either side for rounding
+    std::int32_t v_first = static_cast<std::int32_t>(std::floor(first)) - 1;
+    std::int32_t v_last = static_cast<std::int32_t>(std::ceil(last)) + 1;
+    std::int32_t lowest = std::max(v_first, 0);
+    std::int32_t highest = std::min(v_last, size - 1);
+    if (reflect) {
+        // coordinates outside the frame read the pixels they reflect back to
+        lowest = size - 1;
+        highest = 0;
+        for (std::int32_t v = v_first; v <= v_last && (lowest > 0 || highest < size - 1); ++v) {
+            std::int32_t pixel = mirror(v, size);
+            lowest = std::min(lowest, pixel);
+            highest = std::max(highest, pixel);
+        }
+    }
+    *start = static_cast<std::uint32_t>(std::min(lowest, size - 1));
+    *length = highest >= lowest ? static_cast<std::uint32_t>(highest - lowest + 1) : 0;
+}
+
+void Kaleidoscope::copy_footprint(const State& state, const std::uint8_t* in_frame, std::vector<std::uint8_t>* copy)
+{
+    // the rows of the footprint are packed, read through its origin and row size
+    std::size_t first = offset(state.footprint_x, state.footprint_y);
+    std::size_t row_size = static_cast<std::size_t>(state.footprint_width) * m_pixel_size;
+    copy->resize(row_size * state.footprint_height);
+    for (std::uint32_t y = 0; y < state.footprint_height; ++y) {
+        std::memcpy(copy->data() + y * row_size, in_frame + first + static_cast<std::size_t>(y) * m_stride, row_size);
+    }
+}
+
+void Kaleidoscope::pad_frame(const State& state, const std::uint8_t* in_frame, std::uint8_t* padded, std::size_t stride, std::uint32_t n_threads)
+{
+    Pad_task task(this, &state, in_frame, padded, stride);
+    std::unique_ptr<Thread_pool::Job> job(acquire_job());
+    Thread_pool::instance().run(job.get(), &task, task.size(), n_threads);
+    release_job(std::move(job));
+}
+
+Kaleidoscope::Pad_task::Pad_task(Kaleidoscope* kaleidoscope, const State* state, const std::uint8_t* in_frame, std::uint8_t* padded, std::size_t stride):
+    m_kaleidoscope(kaleidoscope),
+    m_state(state),
+    m_in_frame(in_frame),
+    m_padded(padded),
+    m_stride(stride),
+    m_n_rows(kaleidoscope->m_height + state->pad_top + state->pad_bottom)
+{}
+
+std::uint32_t Kaleidoscope::Pad_task::size() const
+{
+    return (m_n_rows + band_rows - 1) / band_rows;
+}
+
+void Kaleidoscope::Pad_task::mirror_row(const std::uint8_t* in, std::int32_t x_start, std::int32_t x_end, std::uint8_t* out) const
+{
+    const std::int32_t width = static_cast<std::int32_t>(m_kaleidoscope->m_width);
+    const std::size_t pixel_size = m_kaleidoscope->m_pixel_size;
+    if (pixel_size == 4) {
+        // a fixed size copy is a single load and store
+        for (std::int32_t x = x_start; x < x_end; ++x, out += 4) {
+            std::memcpy(out, in + mirror(x, width) * 4, 4);
+        }
+        return;
+    }
+    for (std::int32_t x = x_start; x < x_end; ++x, out += pixel_size) {
+        std::memcpy(out, in + mirror(x, width) * pixel_size, pixel_size);
+    }
+}
+
+void Kaleidoscope::Pad_task::run(std::uint32_t index)
+{
+    const std::int32_t width = static_cast<std::int32_t>(m_kaleidoscope->m_width);
+    const std::int32_t height = static_cast<std::int32_t>(m_kaleidoscope->m_height);
+    const std::size_t pixel_size = m_kaleidoscope->m_pixel_size;
+    const std::uint32_t end = std::min(index * band_rows + band_rows, m_n_rows);
+    for (std::uint32_t row = index * band_rows; row < end; ++row) {
+        std::int32_t y = mirror(static_cast<std::int32_t>(row) - m_state->pad_top, height);
+        const std::uint8_t* in = m_in_frame + static_cast<std::size_t>(y) * m_kaleidoscope->m_stride;
+        std::uint8_t* out = m_padded + row * m_stride;
+        mirror_row(in, -m_state->pad_left, 0, out);
+        out += m_state->pad_left * pixel_size;
+        std::memcpy(out, in, width * pixel_size);
+        out += width * pixel_size;
+        mirror_row(in, width, width + m_state->pad_right, out);
+    }
+}
+
+Kaleidoscope::Tile_task::Tile_task(Kaleidoscope* kaleidoscope, std::shared_ptr<const State> state, const std::uint8_t* in_frame, std::uint8_t* out_frame, std::uint32_t tile_size, bool stream):
+    m_kaleidoscope(kaleidoscope),
+    m_state(state),
+    m_in_frame(in_frame),
+    m_out_frame(out_frame),
+    m_tile_size(tile_size),
+    m_n_tiles_x((kaleidoscope->m_width + m_tile_size - 1) / m_tile_size),
+    m_n_tiles_y((kaleidoscope->m_height + m_tile_size - 1) / m_tile_size),
+    m_stream(stream),
+    m_step(1),
+    m_proxy(1),
+    m_refine(false),
+    m_padded(nullptr),
+    m_padded_stride(0),
+    m_footprint(nullptr),
+    m_footprint_x(0),
+    m_footprint_y(0),
+    m_footprint_stride(0)
+{}
+
+std::uint32_t Kaleidoscope::Tile_task::size() const
+{
+    return m_n_tiles_x * m_n_tiles_y;
+}
+
+Kaleidoscope::Block Kaleidoscope::Tile_task::block(std::uint32_t index) const
+{
+    std::uint32_t x_start = (index % m_n_tiles_x) * m_tile_size;
+    std::uint32_t y_start = (index / m_n_tiles_x) * m_tile_size;
+
+    Block tile(m_state.get(), m_in_frame, m_out_frame,
+        x_start, y_start,
+        std::min(x_start + m_tile_size, m_kaleidoscope->m_width) - 1,
+        std::min(y_start + m_tile_size, m_kaleidoscope->m_height) - 1,
+        m_stream);
+    tile.table = m_table ? m_table->mapping->offsets : nullptr;
+    if (m_source) {
+        tile.in_frame = m_source->pixels.get();
+        tile.table = m_source->offsets.get();
+    }
+    tile.step = m_step;
+    tile.proxy = m_proxy;
+    tile.refine = m_refine;
+    if (m_padded) {
+        tile.in_frame = m_padded;
+        tile.in_stride = m_padded_stride;
+        tile.padded = true;
+    }
+    if (m_footprint) {
+        tile.in_frame = m_footprint;
+        tile.in_stride = m_footprint_stride;
+        tile.in_x = m_footprint_x;
+        tile.in_y = m_footprint_y;
+        tile.footprint = true;
+    }
+    return tile;
+}
 
-        std::vector<std::future<void>> futures;
-        std::vector<std::unique_ptr<Block>> blocks;
+void Kaleidoscope::Tile_task::set_table(std::shared_ptr<const Remap_table> table)
+{
+    m_table = table;
+}
 
-        std::uint32_t block_height = m_height / n_threads;
-        std::uint32_t y_start = 0;
-        std::uint32_t y_end = m_height - block_height * (n_threads - 1) - 1;
+void Kaleidoscope::Tile_task::set_source(std::shared_ptr<const Source_layout> source)
+{
+    m_source = source;
+}
 
-        for (std::uint32_t i = 0; i < n_threads; ++i) {
-            blocks.emplace_back(new Block(
-                reinterpret_cast<const std::uint8_t*>(in_frame),
-                reinterpret_cast<std::uint8_t*>(out_frame),
-                0, y_start,
-                m_width - 1, y_end));
+void Kaleidoscope::Tile_task::set_step(std::uint32_t step)
+{
+    m_step = step;
+}
+
+void Kaleidoscope::Tile_task::set_proxy(std::uint32_t proxy)
+{
+    m_proxy = proxy;
+}
+
+void Kaleidoscope::Tile_task::set_refine(bool refine)
+{
+    m_refine = refine;
+}
+
+void Kaleidoscope::Tile_task::set_padded(const std::uint8_t* in_frame, std::size_t stride)
+{
+    m_padded = in_frame;
+    m_padded_stride = stride;
+}
+
+void Kaleidoscope::Tile_task::set_footprint(const std::uint8_t* in_frame, std::uint32_t x, std::uint32_t y, std::size_t stride)
+{
+    m_footprint = in_frame;
+    m_footprint_x = x;
+    m_footprint_y = y;
+    m_footprint_stride = stride;
+}
+
+Kaleidoscope::Block Kaleidoscope::Tile_task::frame() const
+{
+    Block frame(m_state.get(), m_in_frame, m_out_frame,
+        0, 0,
+        m_kaleidoscope->m_width - 1, m_kaleidoscope->m_height - 1,
+        m_stream);
+    frame.table = m_table ? m_table->mapping->offsets : nullptr;
+    if (m_source) {
+        frame.in_frame = m_source->pixels.get();
+        frame.table = m_source->offsets.get();
+    }
+    frame.step = m_step;
+    frame.proxy = m_proxy;
+    frame.refine = m_refine;
+    if (m_padded) {
+        frame.in_frame = m_padded;
+        frame.in_stride = m_padded_stride;
+        frame.padded = true;
+    }
+    if (m_footprint) {
+        frame.in_frame = m_footprint;
+        frame.in_stride = m_footprint_stride;
+        frame.in_x = m_footprint_x;
+        frame.in_y = m_footprint_y;
+        frame.footprint = true;
+    }
+    return frame;
+}
+
+void Kaleidoscope::Tile_task::run(std::uint32_t index)
+{
+    Block tile(block(index));
+    m_kaleidoscope->dispatch(&tile);
+}
+
+std::uint32_t Kaleidoscope::Batch_task::size() const
+{
+    return Tile_task::size() * m_count;
+}
+
+void Kaleidoscope::Batch_task::run(std::uint32_t index)
+{
+    std::uint32_t frame = index / Tile_task::size();
+    Block tile(block(index % Tile_task::size()));
+    tile.in_frame = m_in_frames[frame];
+    tile.out_frame = m_out_frames[frame];
+    m_kaleidoscope->dispatch(&tile);
+}
+
+Kaleidoscope::Block Kaleidoscope::Batch_task::frame(std::uint32_t index) const
+{
+    Block frame(Tile_task::frame());
+    frame.in_frame = m_in_frames[index];
+    frame.out_frame = m_out_frames[index];
+    return frame;
+}
 
+std::uint32_t Kaleidoscope::View_task::size() const
+{
+    return Tile_task::size() * m_n_groups;
+}
+
+void Kaleidoscope::View_task::run(std::uint32_t index)
+{
+    process(block(index / m_n_groups), index % m_n_groups);
+}
+
+void Kaleidoscope::View_task::process(Block tile, std::uint32_t group)
+{
+    const View* first = m_views + m_groups[group];
+    const View* last = m_views + m_groups[group + 1];
+#ifdef USE_SSE2
+    if (first->shared) {
+        m_kaleidoscope->process_block_views(tile, first, static_cast<std::uint32_t>(last - first));
+        return;
+    }
+#endif
+    for (const View* view = first; view != last; ++view) {
+        tile.state = view->state.get();
+        tile.out_frame = view->out_frame;
+        tile.stream = view->stream;
+        tile.table = view->table ? view->table->mapping->offsets : nullptr;
+        tile.proxy = view->state->proxy_factor;
+        view->kaleidoscope->dispatch(&tile);
+    }
+}
+
+void Kaleidoscope::Blend_task::run(std::uint32_t index)
+{
+    blend(block(index));
+}
+
+void Kaleidoscope::Blend_task::blend(const Block& tile)
+{
+    const Kaleidoscope& kaleidoscope = *m_kaleidoscope;
+    const std::uint32_t pixel_size = kaleidoscope.m_pixel_size;
+    // a multiple of 4 pixels so the runs stay aligned to the groups the effect is evaluated in
+    const std::uint32_t run = blend_run_bytes / pixel_size / 4 * 4;
+    std::uint8_t samples[blend_run_bytes];
+    float sums[blend_run_bytes];
+
+    for (std::uint32_t y = tile.y_start; y <= tile.y_end; ++y) {
+        for (std::uint32_t x = tile.x_start; x <= tile.x_end; x += run) {
+            const std::uint32_t x_end = std::min(x + run - 1, tile.x_end);
+            const std::size_t n_bytes = static_cast<std::size_t>(x_end - x + 1) * pixel_size;
+            std::uint8_t* out = m_out_frame + kaleidoscope.offset(x, y);
+            for (std::uint32_t l = 0; l < m_count; ++l) {
+                const Layer& layer = m_layers[l];
+                if (!layer.state->edge_reflect && !layer.state->background_colour) {
+                    // the pixels the layer leaves unwritten keep the output frame
+                    std::memcpy(samples, out, n_bytes);
+                }
+                // render the run into samples, which hold the pixels from x,y on
+                Block block(layer.state.get(), m_in_frame, samples, x, y, x_end, y, false);
+                block.out_offset = kaleidoscope.offset(x, y);
+                block.table = layer.table ? layer.table->mapping->offsets : nullptr;
+                layer.kaleidoscope->dispatch(&block);
+                const float weight = layer.weight;
+                if (l == 0) {
+                    for (std::size_t i = 0; i < n_bytes; ++i) {
+                        sums[i] = weight * samples[i];
+                    }
+                } else {
+                    for (std::size_t i = 0; i < n_bytes; ++i) {
+                        sums[i] += weight * samples[i];
+                    }
+                }
+            }
+            for (std::size_t i = 0; i < n_bytes; ++i) {
+                out[i] = static_cast<std::uint8_t>(std::min(std::max(sums[i] + 0.5f, 0.0f), 255.0f));
+            }
+        }
+    }
+}
+
+void Kaleidoscope::Remap_task::run(std::uint32_t index)
+{
+    Block tile(block(index));
+    const State& state = *m_state;
+    for (std::uint32_t y = tile.y_start; y <= tile.y_end; ++y) {
+        std::uint32_t* offsets = m_table + static_cast<std::size_t>(y) * m_kaleidoscope->m_width + tile.x_start;
 #ifdef USE_SSE2
-            futures.push_back(std::async(std::launch::async, m_edge_reflect ? &Kaleidoscope::process_block : &Kaleidoscope::process_block_bg, this, blocks[i].get()));
+        for (std::uint32_t x = tile.x_start; x <= tile.x_end; x += 4, offsets += 4) {
+            std::size_t source[4];
+            m_kaleidoscope->source_offsets(state, tile, x, y, source);
+            for (int i = 0; i < 4; ++i) {
+                offsets[i] = source[i] == no_source ? table_no_source : static_cast<std::uint32_t>(source[i]);
+            }
+        }
 #else
-            futures.push_back(std::async(std::launch::async, &Kaleidoscope::process_block, this, blocks[i].get()));
+        for (std::uint32_t x = tile.x_start; x <= tile.x_end; ++x, ++offsets) {
+            std::size_t offset = m_kaleidoscope->source_offset(state, tile, x, y);
+            *offsets = offset == no_source ? table_no_source : static_cast<std::uint32_t>(offset);
+        }
 #endif
-            y_start = y_end + 1;
-            y_end += block_height;
+    }
+}
+
+std::shared_ptr<const Kaleidoscope::Remap_table> Kaleidoscope::remap_table(const std::shared_ptr<const State>& state, const Tuning& tuning)
+{
+    if (static_cast<std::size_t>(m_stride) * m_height >= table_no_source) {
+        return nullptr;
+    }
+    std::shared_ptr<const Remap_table> table(std::atomic_load(&m_remap));
+    if (table && table->state->mapping_version == state->mapping_version) {
+        return table;
+    }
+    if (state->remap_rebuild != Remap_rebuild::BLOCKING) {
+        request_remap_table(state);
+        return state->remap_rebuild == Remap_rebuild::PREVIOUS ? table : nullptr;
+    }
+    return publish_remap_table(build_remap_table(state, tuning));
+}
+
+std::shared_ptr<const Kaleidoscope::Remap_table> Kaleidoscope::publish_remap_table(const std::shared_ptr<const Remap_table>& table)
+{
+    std::lock_guard<std::mutex> lock(m_remap_mutex);
+    std::shared_ptr<const Remap_table> current(std::atomic_load(&m_remap));
+    if (current && current->state->mapping_version >= table->state->mapping_version) {
+        // a table for the same or later settings was published while this one was built
+        return current->state->mapping_version == table->state->mapping_version ? current : table;
+    }
+    if (state()->remap_table) {
+        std::atomic_store(&m_remap, table);
+    }
+    return table;
+}
+
+std::shared_ptr<const Kaleidoscope::Remap_table> Kaleidoscope::build_remap_table(const std::shared_ptr<const State>& state, const Tuning& tuning)
+{
+    auto start = std::chrono::steady_clock::now();
+    // another instance with the same mapping may have built it already
+    Mapping_cache::Key key(m_width, m_height, m_stride, m_pixel_size,
+        state->origin_x, state->origin_y,
+        state->n_segments, state->start_angle,
+        state->edge_reflect, state->edge_reflect ? 0 : state->edge_threshold,
+#ifdef USE_SSE2
+        true
+#else
+        false
+#endif
+        );
+    std::shared_ptr<const Mapping> mapping(Mapping_cache::instance().find(key));
+    if (!mapping) {
+        std::size_t n_pixels = static_cast<std::size_t>(m_width) * m_height;
+        std::shared_ptr<Mapping> built(new Mapping());
+        built->data.reset(new std::uint32_t[n_pixels]);
+        built->offsets = built->data.get();
+        built->size = n_pixels * sizeof(std::uint32_t);
+        Remap_task task(this, state, built->data.get(), tuning.tile_size);
+        std::unique_ptr<Thread_pool::Job> job(acquire_job());
+        Thread_pool::instance().run(job.get(), &task, task.size(), tuning.n_threads);
+        release_job(std::move(job));
+        mapping = Mapping_cache::instance().insert(key, built);
+    }
+    m_remap_build_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    std::shared_ptr<Remap_table> remap(new Remap_table());
+    remap->state = state;
+    remap->mapping = mapping;
+    return remap;
+}
+
+void Kaleidoscope::fingerprint(const std::uint8_t* frame, std::uint64_t* hash) const
+{
+    std::size_t row_size = static_cast<std::size_t>(m_width) * m_pixel_size;
+#ifdef USE_SSE2
+    // accumulates the product of the halves of each 64 bit lane of the data mixed with a key
+    // that changes with position, so reordered data gives a different fingerprint. Four
+    // accumulators take 64 bytes at a time so the multiplies overlap.
+    const __m128i key_step = _mm_set1_epi32(static_cast<int>(0x9E3779B1));
+    const __m128i prime = _mm_set1_epi32(static_cast<int>(0x85EBCA77));
+    __m128i acc[4];
+    __m128i key[4];
+    for (int i = 0; i < 4; ++i) {
+        acc[i] = _mm_set_epi32(0x165667B1 + i, static_cast<int>(0xC2B2AE3D), 0x27D4EB2F, static_cast<int>(0x85EBCA77));
+        key[i] = _mm_set_epi32(0x3C6EF372, static_cast<int>(0xBB67AE85) + i, 0x6A09E667, static_cast<int>(0xA54FF53A));
+    }
+    ALIGN16_BEG std::uint8_t ALIGN16_END tail[64];
+    for (std::uint32_t y = 0; y < m_height; ++y) {
+        const std::uint8_t* row = frame + static_cast<std::size_t>(y) * m_stride;
+        for (std::size_t x = 0; x < row_size; x += 64) {
+            const std::uint8_t* block = row + x;
+            if (x + 64 > row_size) {
+                std::memset(tail, 0, sizeof(tail));
+                std::memcpy(tail, block, row_size - x);
+                block = tail;
+            }
+            for (int i = 0; i < 4; ++i) {
+                __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block) + i);
+                __m128i mixed = _mm_xor_si128(data, key[i]);
+                __m128i product = _mm_mul_epu32(mixed, _mm_shuffle_epi32(mixed, _MM_SHUFFLE(2, 3, 0, 1)));
+                acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+                key[i] = _mm_add_epi32(key[i], key_step);
+            }
         }
-        for (auto& f : futures) {
-            f.wait();
+        // scramble each row into the next
+        for (int i = 0; i < 4; ++i) {
+            acc[i] = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+            acc[i] = _mm_add_epi64(_mm_mul_epu32(acc[i], prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(acc[i], 32), prime), 32));
         }
     }
-    
+    __m128i merged = _mm_xor_si128(_mm_add_epi64(acc[0], acc[2]), _mm_add_epi64(_mm_shuffle_epi32(acc[1], _MM_SHUFFLE(1, 0, 3, 2)), acc[3]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(hash), merged);
+#else
+    std::uint64_t h0 = 0x9E3779B97F4A7C15ull;
+    std::uint64_t h1 = 0xC2B2AE3D27D4EB4Full;
+    for (std::uint32_t y = 0; y < m_height; ++y) {
+        const std::uint8_t* row = frame + static_cast<std::size_t>(y) * m_stride;
+        for (std::size_t x = 0; x < row_size; x += 8) {
+            std::uint64_t data = 0;
+            std::memcpy(&data, row + x, std::min<std::size_t>(8, row_size - x));
+            h0 = ((h0 ^ data) << 31 | (h0 ^ data) >> 33) * 0x9E3779B97F4A7C15ull;
+            h1 = (h1 + data) * 0xC2B2AE3D27D4EB4Full;
+            h1 ^= h1 >> 29;
+        }
+    }
+    hash[0] = h0;
+    hash[1] = h1;
+#endif
+}
+
+std::size_t Kaleidoscope::tiled_offset(std::size_t offset) const
+{
+    std::size_t y = offset / m_stride;
+    std::size_t x = offset % m_stride / m_pixel_size;
+    std::size_t tiles_x = (m_width + source_tile - 1) / source_tile;
+    std::size_t tile = (y / source_tile) * tiles_x + x / source_tile;
+    return (tile * source_tile * source_tile + (y % source_tile) * source_tile + x % source_tile) * m_pixel_size;
+}
+
+std::shared_ptr<const Kaleidoscope::Source_layout> Kaleidoscope::source_layout(const std::uint8_t* in_frame, const std::uint64_t* hash, const std::shared_ptr<const Remap_table>& table)
+{
+    std::size_t tiles_x = (m_width + source_tile - 1) / source_tile;
+    std::size_t tiles_y = (m_height + source_tile - 1) / source_tile;
+    std::size_t size = tiles_x * tiles_y * source_tile * source_tile * m_pixel_size;
+    if (size >= table_no_source) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_source_mutex);
+    std::shared_ptr<const Source_layout> current(std::atomic_load(&m_source));
+    bool unchanged = current && current->fingerprint[0] == hash[0] && current->fingerprint[1] == hash[1];
+    if (unchanged && current->pixels && current->table == table) {
+        return current;
+    }
+    std::shared_ptr<Source_layout> layout(new Source_layout());
+    layout->fingerprint[0] = hash[0];
+    layout->fingerprint[1] = hash[1];
+    if (!unchanged) {
+        // only copied once the input is seen twice, a changing input is never copied
+        std::atomic_store(&m_source, std::shared_ptr<const Source_layout>(layout));
+        return nullptr;
+    }
+    if (current->pixels) {
+        layout->pixels = current->pixels;
+    } else {
+        std::shared_ptr<std::uint8_t> pixels(new std::uint8_t[size], std::default_delete<std::uint8_t[]>());
+        for (std::uint32_t y = 0; y < m_height; ++y) {
+            for (std::uint32_t x = 0; x < m_width; x += source_tile) {
+                std::size_t offset = static_cast<std::size_t>(y) * m_stride + static_cast<std::size_t>(x) * m_pixel_size;
+                std::size_t n_pixels = std::min(static_cast<std::uint32_t>(source_tile), m_width - x);
+                std::memcpy(pixels.get() + tiled_offset(offset), in_frame + offset, n_pixels * m_pixel_size);
+            }
+        }
+        layout->pixels = pixels;
+    }
+    std::size_t n_pixels = static_cast<std::size_t>(m_width) * m_height;
+    const std::uint32_t* offsets = table->mapping->offsets;
+    layout->offsets.reset(new std::uint32_t[n_pixels]);
+    for (std::size_t i = 0; i < n_pixels; ++i) {
+        layout->offsets[i] = offsets[i] == table_no_source ? table_no_source : static_cast<std::uint32_t>(tiled_offset(offsets[i]));
+    }
+    layout->table = table;
+    std::atomic_store(&m_source, std::shared_ptr<const Source_layout>(layout));
+    return layout;
+}
+
+std::uint64_t Kaleidoscope::output_key(const State& state)
+{
+    // FNV-1a of each setting in turn
+    std::uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void* value, std::size_t size) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(value);
+        for (std::size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    std::uint32_t settings[] = {
+        state.segmentation,
+        static_cast<std::uint32_t>(state.segment_direction),
+        static_cast<std::uint32_t>(state.preferred_corner),
+        static_cast<std::uint32_t>(state.preferred_search_dir),
+        state.edge_reflect,
+        state.edge_reflect ? 0 : state.edge_threshold,
+        state.proxy_factor,
+        // may pick the neighbouring pixel where a coordinate lands exactly on a pixel edge
+        state.edge_reflect && state.mirror_padding
+    };
+    float coordinates[] = { state.origin_x, state.origin_y, state.source_segment_angle };
+    add(settings, sizeof(settings));
+    add(coordinates, sizeof(coordinates));
+    return hash;
+}
+
+bool Kaleidoscope::find_output(const std::uint64_t* key, std::uint8_t* out_frame)
+{
+    std::size_t row_size = static_cast<std::size_t>(m_width) * m_pixel_size;
+    std::lock_guard<std::mutex> lock(m_output_mutex);
+    for (auto output = m_outputs.begin(); output != m_outputs.end(); ++output) {
+        if (std::equal(key, key + 3, output->key)) {
+            m_outputs.splice(m_outputs.begin(), m_outputs, output);
+            for (std::uint32_t y = 0; y < m_height; ++y) {
+                std::memcpy(lookup(out_frame, 0, y), output->pixels.get() + y * row_size, row_size);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void Kaleidoscope::cache_output(const std::uint64_t* key, const std::uint8_t* out_frame, std::uint64_t bytes)
+{
+    std::size_t row_size = static_cast<std::size_t>(m_width) * m_pixel_size;
+    std::size_t frame_size = row_size * m_height;
+    std::size_t capacity = static_cast<std::size_t>(std::min<std::uint64_t>(bytes / frame_size, SIZE_MAX));
+    std::lock_guard<std::mutex> lock(m_output_mutex);
+    while (m_outputs.size() > capacity) {
+        m_outputs.pop_back();
+    }
+    if (capacity == 0) {
+        return;
+    }
+    if (m_outputs.size() < capacity) {
+        m_outputs.emplace_front();
+        m_outputs.front().pixels.reset(new std::uint8_t[frame_size]);
+    } else {
+        // reuse the least recently used frame
+        m_outputs.splice(m_outputs.begin(), m_outputs, std::prev(m_outputs.end()));
+    }
+    Cached_output& output = m_outputs.front();
+    std::copy(key, key + 3, output.key);
+    for (std::uint32_t y = 0; y < m_height; ++y) {
+        std::memcpy(output.pixels.get() + y * row_size, lookup(out_frame, 0, y), row_size);
+    }
+}
+
+void Kaleidoscope::request_remap_table(const std::shared_ptr<const State>& state)
+{
+    std::lock_guard<std::mutex> lock(m_builder_mutex);
+    if (m_remap_request && m_remap_request->mapping_version == state->mapping_version) {
+        return;
+    }
+    // replaces any request not yet started, only the latest settings are worth building
+    m_remap_request = state;
+    if (!m_builder.joinable()) {
+        m_builder = std::thread(&Kaleidoscope::build_remap_tables, this);
+    }
+    m_builder_wake.notify_one();
+}
+
+void Kaleidoscope::build_remap_tables()
+{
+    std::unique_lock<std::mutex> lock(m_builder_mutex);
+    while (true) {
+        m_builder_wake.wait(lock, [this] { return m_builder_stop || m_remap_request; });
+        if (m_builder_stop) {
+            return;
+        }
+        std::shared_ptr<const State> state(m_remap_request);
+        lock.unlock();
+        std::shared_ptr<const Remap_table> table(std::atomic_load(&m_remap));
+        if (this->state()->remap_table && !(table && table->state->mapping_version == state->mapping_version)) {
+            // on this thread alone so frames processed meanwhile keep the processing threads,
+            // and without the lock so they and the setters aren't held up by the build
+            publish_remap_table(build_remap_table(state, Tuning(1, state->tile_size)));
+        }
+        lock.lock();
+        if (m_remap_request == state) {
+            m_remap_request.reset();
+        }
+    }
+}
+
+void Kaleidoscope::Touch_task::run(std::uint32_t index)
+{
+    Block tile(block(index));
+    std::size_t row_size = m_kaleidoscope->m_pixel_size * static_cast<std::size_t>(tile.x_end - tile.x_start + 1);
+    for (std::uint32_t y = tile.y_start; y <= tile.y_end; ++y) {
+        std::memset(m_kaleidoscope->lookup(tile.out_frame, tile.x_start, y), 0, row_size);
+    }
+}
+
+std::int32_t Kaleidoscope::first_touch(void* frame)
+{
+    if (frame == nullptr) {
+        return -2;
+    }
+    std::shared_ptr<const State> state(this->state());
+    Tuning tuning(this->tuning(*state, false));
+    Touch_task task(this, state, reinterpret_cast<std::uint8_t*>(frame), tuning.tile_size);
+    std::unique_ptr<Thread_pool::Job> job(acquire_job());
+    Thread_pool::instance().run(job.get(), &task, task.size(), tuning.n_threads);
+    release_job(std::move(job));
     return 0;
 }
 
+std::uint64_t Kaleidoscope::cost_key(const State& state)
+{
+    return (std::uint64_t(state.segmentation) << 6) | (state.proxy_factor << 2) | (state.edge_reflect ? 2 : 0) | (state.remap_table ? 1 : 0);
+}
+
+Tuning Kaleidoscope::tuning(const State& state, bool online)
+{
+    if (state.n_threads != 0) {
+        return Tuning(thread_count(state.n_threads), state.tile_size);
+    }
+    std::uint32_t available = thread_count(0);
+    Tuning tuned(available, state.tile_size);
+    if (Tuning_profile::instance().lookup(m_width, m_height, m_pixel_size, state.segmentation, state.edge_reflect, &tuned)) {
+        tuned.n_threads = thread_count(tuned.n_threads);
+    }
+    if (online && state.auto_tuning) {
+        tuned = m_tuner.next(cost_key(state), tuned, available);
+    }
+    return tuned;
+}
+
+std::uint32_t Kaleidoscope::thread_count(std::uint32_t threading)
+{
+    std::uint32_t available = Thread_pool::instance().size() + 1;
+    return threading == 0 ? available : std::min(threading, available);
+}
+
+bool Kaleidoscope::use_streaming_stores(const State& state, const void* out_frame) const
+{
+#ifdef USE_SSE2
+    // streaming stores write whole aligned groups of 4 pixels so only 4 byte pixels
+    // on 16 byte aligned rows qualify
+    return state.streaming_threshold != 0 &&
+        state.edge_reflect &&
+        static_cast<std::size_t>(m_stride) * m_height >= state.streaming_threshold &&
+        m_pixel_size == 4 &&
+        m_stride % 16 == 0 &&
+        reinterpret_cast<std::uintptr_t>(out_frame) % 16 == 0;
+#else
+    (void)state;
+    (void)out_frame;
+    return false;
+#endif
+}
+
 std::int32_t Kaleidoscope::set_threading(std::uint32_t threading)
 {
-    m_n_threads = threading;
+    update([threading](State* state) { state->n_threads = threading; });
     return 0;
 }
 
 std::uint32_t Kaleidoscope::get_threading() const
 {
-    return m_n_threads;
+    return state()->n_threads;
+}
+
+std::int32_t Kaleidoscope::set_tile_size(std::uint32_t size)
+{
+    if (size == 0 || size % 4 != 0) {
+        return -2;
+    }
+    update([size](State* state) { state->tile_size = size; });
+    return 0;
+}
+
+std::uint32_t Kaleidoscope::get_tile_size() const
+{
+    return state()->tile_size;
+}
+
+std::int32_t Kaleidoscope::set_auto_tuning(bool enabled)
+{
+    update([enabled](State* state) { state->auto_tuning = enabled; });
+    return 0;
+}
+
+bool Kaleidoscope::get_auto_tuning() const
+{
+    return state()->auto_tuning;
+}
+
+std::int32_t Kaleidoscope::set_remap_table(bool enabled)
+{
+    update([enabled](State* state) { state->remap_table = enabled; });
+    if (!enabled) {
+        // release the memory, frames in progress keep their own reference
+        std::lock_guard<std::mutex> lock(m_remap_mutex);
+        std::atomic_store(&m_remap, std::shared_ptr<const Remap_table>());
+    }
+    return 0;
+}
+
+bool Kaleidoscope::get_remap_table() const
+{
+    return state()->remap_table;
+}
+
+std::int32_t Kaleidoscope::set_remap_rebuild(Remap_rebuild rebuild)
+{
+    update([rebuild](State* state) { state->remap_rebuild = rebuild; });
+    return 0;
+}
+
+Kaleidoscope::Remap_rebuild Kaleidoscope::get_remap_rebuild() const
+{
+    return state()->remap_rebuild;
+}
+
+bool Kaleidoscope::get_frame_stale() const
+{
+    return m_frame_stale;
+}
+
+std::int32_t Kaleidoscope::set_source_cache(bool enabled)
+{
+    update([enabled](State* state) { state->source_cache = enabled; });
+    if (!enabled) {
+        // release the copy, frames in progress keep their own reference
+        std::atomic_store(&m_source, std::shared_ptr<const Source_layout>());
+    }
+    return 0;
+}
+
+bool Kaleidoscope::get_source_cache() const
+{
+    return state()->source_cache;
+}
+
+std::int32_t Kaleidoscope::set_mirror_padding(bool enabled)
+{
+    update([enabled](State* state) { state->mirror_padding = enabled; });
+    if (!enabled) {
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        m_free_copies.clear();
+    }
+    return 0;
+}
+
+bool Kaleidoscope::get_mirror_padding() const
+{
+    return state()->mirror_padding;
+}
+
+std::int32_t Kaleidoscope::get_source_footprint(std::uint32_t* x, std::uint32_t* y, std::uint32_t* width, std::uint32_t* height) const
+{
+    if (x == nullptr || y == nullptr || width == nullptr || height == nullptr) {
+        return -2;
+    }
+    std::shared_ptr<const State> state(this->state());
+    *x = state->footprint_x;
+    *y = state->footprint_y;
+    *width = state->footprint_width;
+    *height = state->footprint_height;
+    return 0;
+}
+
+std::int32_t Kaleidoscope::set_output_cache(std::uint64_t bytes)
+{
+    update([bytes](State* state) { state->output_cache = bytes; });
+    if (bytes == 0) {
+        std::lock_guard<std::mutex> lock(m_output_mutex);
+        m_outputs.clear();
+    }
+    return 0;
+}
+
+std::uint64_t Kaleidoscope::get_output_cache() const
+{
+    return state()->output_cache;
+}
+
+std::uint64_t Kaleidoscope::get_output_cache_hits() const
+{
+    return m_output_hits;
+}
+
+std::uint64_t Kaleidoscope::get_output_cache_misses() const
+{
+    return m_output_misses;
+}
+
+float Kaleidoscope::get_remap_build_time() const
+{
+    return m_remap_build_time;
+}
+
+std::int32_t Kaleidoscope::set_frame_deadline(float seconds)
+{
+    if (!(seconds >= 0) || std::isinf(seconds)) {
+        return -2;
+    }
+    update([seconds](State* state) { state->frame_deadline = seconds; });
+    return 0;
+}
+
+float Kaleidoscope::get_frame_deadline() const
+{
+    return state()->frame_deadline;
+}
+
+Kaleidoscope::Quality Kaleidoscope::get_frame_quality() const
+{
+    return m_frame_quality;
+}
+
+std::int32_t Kaleidoscope::set_proxy_factor(std::uint32_t factor)
+{
+    if (factor != 1 && factor != 2 && factor != 4 && factor != 8) {
+        return -2;
+    }
+    update([factor](State* state) { state->proxy_factor = factor; });
+    return 0;
+}
+
+std::uint32_t Kaleidoscope::get_proxy_factor() const
+{
+    return state()->proxy_factor;
+}
+
+std::uint32_t Kaleidoscope::get_thread_busy_times(float* busy_times, std::uint32_t count) const
+{
+    std::lock_guard<std::mutex> lock(m_busy_mutex);
+    if (busy_times) {
+        std::copy_n(m_busy_times.begin(), std::min(count, static_cast<std::uint32_t>(m_busy_times.size())), busy_times);
+    }
+    return static_cast<std::uint32_t>(m_busy_times.size());
+}
+
+std::int32_t Kaleidoscope::set_prefetch_distance(std::uint32_t distance)
+{
+    if (distance > max_prefetch_distance) {
+        return -2;
+    }
+    // round up to whole groups of 4 pixels
+    update([distance](State* state) { state->prefetch_distance = (distance + 3) & ~3u; });
+    return 0;
+}
+
+std::uint32_t Kaleidoscope::get_prefetch_distance() const
+{
+    return state()->prefetch_distance;
+}
+
+std::int32_t Kaleidoscope::set_streaming_threshold(std::uint32_t threshold)
+{
+    update([threshold](State* state) { state->streaming_threshold = threshold; });
+    return 0;
+}
+
+std::uint32_t Kaleidoscope::get_streaming_threshold() const
+{
+    return state()->streaming_threshold;
 }
 
 std::int32_t Kaleidoscope::visualise(void* out_frame)
@@ -673,9 +2757,7 @@ std::int32_t Kaleidoscope::visualise(void* out_frame)
         return -2;
     }
 #endif
-    if (m_n_segments == 0) {
-        init();
-    }
+    std::shared_ptr<const State> state(this->state());
 
     for (std::uint32_t y = 0; y < m_height; ++y) {
 #ifdef USE_SSE2
@@ -688,7 +2770,7 @@ std::int32_t Kaleidoscope::visualise(void* out_frame)
             ALIGN16_BEG int ALIGN16_END mx[4] = { static_cast<int>(x), static_cast<int>(x) + 1, static_cast<int>(x) + 2, static_cast<int>(x) + 3};
             ALIGN16_BEG int ALIGN16_END my[4] = { static_cast<int>(y), static_cast<int>(y), static_cast<int>(y), static_cast<int>(y) };
             
-            Reflect_info info = calculate_reflect_info((__m128i*)mx, (__m128i*)my);
+            Reflect_info info = calculate_reflect_info(*state, (__m128i*)mx, (__m128i*)my);
             //float* segment_number = reinterpret_cast<float*>(&info.segment_number);
             std::int32_t* segment_number = reinterpret_cast<std::int32_t*>(&info.segment_number_i);
             std::uint32_t col_idx = (*segment_number) % 63;
@@ -734,7 +2816,7 @@ std::int32_t Kaleidoscope::visualise(void* out_frame)
             }
 
 #else
-            Reflect_info info = calculate_reflect_info(x, y);
+            Reflect_info info = calculate_reflect_info(*state, x, y);
             std::uint32_t col_idx = info.segment_number % 63;
             out[0] = colours[col_idx][0];
             out[1] = colours[col_idx][1];
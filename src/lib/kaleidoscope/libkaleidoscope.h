@@ -2,10 +2,19 @@
 #define LIBKALEIDOSCOPE_LIBKALEIDOSCOPE_H 1
 
 #include "ikaleidoscope.h"
+#include "thread_pool.h"
+#include "tuning.h"
+#include "mapping_cache.h"
 
 #include <vector>
+#include <list>
 #include <cmath>
 #include <functional>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 
 #ifndef NO_SSE2
 #if _M_IX86_FP == 2 || _M_X64 == 100
@@ -37,6 +46,11 @@ public:
      */
     Kaleidoscope(std::uint32_t width, std::uint32_t height, std::uint32_t component_size, std::uint32_t num_components, std::uint32_t stride = 0);
 
+    /**
+     * Destructor, waits for any frames still in flight
+     */
+    virtual ~Kaleidoscope();
+
     /**
      * Sets the origin of the kaleidoscope effect. These are given in the range 0 -> 1.
      * Values other than 0.5,0.5 may end up reflecting outside the source image.
@@ -213,6 +227,12 @@ public:
      * Applies the kaleidoscope effect to \p in_frame and returns it in \p out_frame.
      * Each parameter must point to enough memory to contain the image specified in the 
      * constructor.
+     * Several threads may process frames at once, and settings may be changed while they do,
+     * each frame is processed with the settings current when it started.
+     * Once a frame has been processed with the current settings, further frames allocate no memory.
+     * \p in_frame may be \p out_frame to process in place, the region of the input read by
+     * the settings (see #get_source_footprint) is then copied aside first and the effect is
+     * evaluated rather than gathered through a remap table.
      * @param in_frame the input frame to process
      * @param out_frame receives the output image
      * @return
@@ -223,10 +243,89 @@ public:
     virtual std::int32_t process(const void* in_frame, void* out_frame);
 
     /**
-     * Sets the number of threads to use when processing.
+     * Starts applying the kaleidoscope effect to \p in_frame, into \p out_frame, on the
+     * process wide threads and returns without waiting so several frames can be in flight
+     * at once. Small frames are each processed by a single thread, running side by side,
+     * while large frames are split between the threads as with #process.
+     * Each frame is processed with the settings current when it was submitted. Both frames
+     * must remain valid, and \p out_frame must not be read, until the frame has been waited for.
+     * As with #process, steady state submitting and waiting allocate no memory. Unlike
+     * #process the frames must differ.
+     * @param in_frame the input frame to process
+     * @param out_frame receives the output image
+     * @param ticket receives the ticket to pass to #wait
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr or \p in_frame is \p out_frame)
+     */
+    virtual std::int32_t submit(const void* in_frame, void* out_frame, std::uint64_t* ticket);
+
+    /**
+     * Waits for a frame started with #submit to complete, helping to process it. Every
+     * submitted frame must be waited for exactly once, tickets may be waited for in any order
+     * and from any thread.
+     * @param ticket the ticket returned by #submit
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (unknown ticket)
+     */
+    virtual std::int32_t wait(std::uint64_t ticket);
+
+    /**
+     * Applies the kaleidoscope effect to \p count frames with the same settings, scheduling
+     * the tiles of every frame on the process wide threads as a single job. Each thread
+     * works through a run of whole frames and steals tiles from the runs of other threads
+     * once it finishes, so small frames are processed side by side while the last ones are
+     * split between the threads. The settings, remap table and thread count are looked up
+     * once for the whole batch. Frames are processed at full quality, without the frame
+     * deadline, mirror padding or the source and output caches. No output frame may be one
+     * of the input frames or the output frame of another frame.
+     * @param in_frames the \p count input frames to process
+     * @param out_frames the \p count frames to receive the output images
+     * @param count the number of frames
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr, an output frame is an input frame or another output frame, or too many tiles)
+     */
+    virtual std::int32_t process_batch(const void* const* in_frames, void* const* out_frames, std::uint32_t count);
+
+    /**
+     * Renders \p in_frame into \p out_frame progressively, for interactive changes such as
+     * dragging the origin. The first call fills \p out_frame coarsely, evaluating the effect
+     * once per 8x8 block of pixels, and each following call refines it to 4x4, 2x2 and then
+     * every pixel. Each pass only evaluates the pixels earlier passes skipped, so together
+     * they cost about as much as #process. Changing any setting, passing different frames or
+     * calling #cancel_progressive abandons the refinement and starts again from the coarsest pass.
+     * @param in_frame the input frame to process
+     * @param out_frame receives the output image, it must not be modified between passes
+     * @param block_size receives the width and height of the blocks \p out_frame is now
+     * evaluated at, \c 1 once it is at full quality
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr or \p in_frame is \p out_frame, later passes read the input)
+     */
+    virtual std::int32_t process_progressive(const void* in_frame, void* out_frame, std::uint32_t* block_size);
+
+    /**
+     * Abandons progressive rendering so that the next call to #process_progressive starts
+     * again from the coarsest pass, for when the content of the input frame changes.
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t cancel_progressive();
+
+    /**
+     * Sets the number of threads to use when processing. Threads come from a process
+     * wide pool shared by every instance so the count is limited by #set_global_threading.
      * Default to 0.
-     * @p threading the nubmer of threads to use. \c 0, calculate automatically,
-     * otherwise the explicit thread count.
+     * @p threading the nubmer of threads to use. \c 0, use every thread available, or the
+     * thread count and tile size from the tuning profile if it has an entry for the frame format
+     * (see #load_tuning_profile), otherwise the explicit thread count.
      * @return
      *          -  0: Success
      *          - -1: Error
@@ -238,6 +337,293 @@ public:
      */
     virtual std::uint32_t get_threading() const;
 
+    /**
+     * When processing with multiple threads the frame is divided into square tiles which
+     * are dealt out to the threads. Threads that run out of tiles steal them from threads
+     * that are still busy so uneven per pixel costs don't leave threads idle.
+     * Defaults to 64.
+     * @param size the tile width and height in pixels, must be a non zero multiple of 4.
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Parameter out of range
+     */
+    virtual std::int32_t set_tile_size(std::uint32_t size);
+
+    /**
+     * Returns the tile size.
+     */
+    virtual std::uint32_t get_tile_size() const;
+
+    /**
+     * Enables online tuning. While processing frames with #process and threading set to \c 0,
+     * neighbouring thread counts and tile sizes are tried for a few frames at a time and the
+     * fastest kept, starting from the tuning profile's choice. Useful for long renders where
+     * the best choice differs from the profile or the machine's load changes.
+     * Defaults to \c false.
+     * @param enabled \c true to enable online tuning
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_auto_tuning(bool enabled);
+
+    /**
+     * Returns \c true if online tuning is enabled.
+     */
+    virtual bool get_auto_tuning() const;
+
+    /**
+     * Returns the time each thread spent processing the last frame, making load imbalance
+     * between threads visible.
+     * @param busy_times receives the busy time of each thread in seconds, may be \c nullptr
+     * @param count the number of entries \p busy_times can hold
+     * @return the number of threads that processed the last frame
+     */
+    virtual std::uint32_t get_thread_busy_times(float* busy_times, std::uint32_t count) const;
+
+    /**
+     * Enables processing through a remap table. The table holds the source pixel of every
+     * output pixel so, once built, each frame is a plain gather instead of evaluating the
+     * effect per pixel. The table is built in parallel on the processing threads by the
+     * first frame after a setting that changes the mapping, or in the background (see
+     * #set_remap_rebuild), the time this takes is reported by #get_remap_build_time rather
+     * than in the thread busy times.
+     * Tables are shared through a process wide cache by every instance with the same frame
+     * geometry and mapping settings, so only the first of them builds it
+     * (see #set_mapping_cache_budget).
+     * The table uses 4 bytes per pixel. Frames larger than 4GB are processed without it.
+     * Defaults to \c false.
+     * @param enabled \c true to process through a remap table
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_remap_table(bool enabled);
+
+    /**
+     * Returns \c true if processing through a remap table is enabled.
+     */
+    virtual bool get_remap_table() const;
+
+    /**
+     * Returns the time, in seconds, taken to build or fetch from the cache the most recent
+     * remap table or \c 0 if none has been built.
+     */
+    virtual float get_remap_build_time() const;
+
+    /**
+     * Sets how frames are processed while the remap table is rebuilt after a setting that
+     * changes the mapping. With Remap_rebuild::BLOCKING the next frame builds the table
+     * using the processing threads. Otherwise the table is built on a background thread of
+     * the instance, started as soon as the setting changes, only the table for the latest
+     * settings is built, and frames processed meanwhile either evaluate the effect directly
+     * (Remap_rebuild::DIRECT) or gather through the table of earlier settings
+     * (Remap_rebuild::PREVIOUS, see #get_frame_stale). The new table is swapped in once built.
+     * Defaults to Remap_rebuild::BLOCKING.
+     * @param rebuild how the table is rebuilt
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_remap_rebuild(Remap_rebuild rebuild);
+
+    /**
+     * Returns how frames are processed while the remap table is rebuilt.
+     */
+    virtual Remap_rebuild get_remap_rebuild() const;
+
+    /**
+     * Returns \c true if the last frame processed by #process gathered through the remap
+     * table of earlier settings while the table for the current settings was rebuilt.
+     */
+    virtual bool get_frame_stale() const;
+
+    /**
+     * Enables caching a tiled copy of a static input frame. Each frame processed with
+     * #process through a remap table is fingerprinted and, while the input is unchanged,
+     * gathered from a copy laid out in tiles of 4x4 pixels with the remap table translated
+     * to it, so gathers across rows read fewer cache lines. The copy is made by the second
+     * frame with the same input and uses as much memory as the input frame and the table.
+     * The fingerprint reads the whole input frame, so this only pays off when gathers are
+     * limited by cache misses rather than memory bandwidth.
+     * Has no effect without a remap table. Defaults to \c false.
+     * @param enabled \c true to cache a tiled copy of static input frames
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_source_cache(bool enabled);
+
+    /**
+     * Returns \c true if caching a tiled copy of static input frames is enabled.
+     */
+    virtual bool get_source_cache() const;
+
+    /**
+     * Sets the memory budget of the cache of frames rendered by #process, for scrubbing over
+     * still images. Frames are keyed by a fingerprint of the input frame and a hash of the
+     * settings that affect the output, a frame already in the cache is copied to the output
+     * rather than processed. The least recently used frames are dropped when the budget is
+     * reached. Frames are only cached at full quality, and not at all in background mode
+     * without a background colour as the output then depends on the previous output.
+     * The fingerprint reads the whole input frame. Defaults to \c 0, disabled.
+     * @param bytes the budget in bytes, \c 0 to disable the cache
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_output_cache(std::uint64_t bytes);
+
+    /**
+     * Returns the memory budget of the cache of rendered frames in bytes.
+     */
+    virtual std::uint64_t get_output_cache() const;
+
+    /**
+     * Returns the number of frames copied from the cache of rendered frames.
+     */
+    virtual std::uint64_t get_output_cache_hits() const;
+
+    /**
+     * Returns the number of frames processed with the cache of rendered frames enabled
+     * that were not in it.
+     */
+    virtual std::uint64_t get_output_cache_misses() const;
+
+    /**
+     * Enables gathering from a mirror padded copy of the input frame when reflecting back
+     * into the image. Each frame processed with #process evaluating the effect directly,
+     * without a remap table, first copies the input into a larger frame whose border holds
+     * the reflected tessellation out to the furthest source pixel of the current settings,
+     * so pixels are gathered without folding coordinates back into the image. Pays off for
+     * origins off the centre of the frame, where many pixels land outside it, at the cost
+     * of the copy and its memory, which grows with the distance from the origin to the
+     * furthest corner. Only has an effect when built with SSE2. Defaults to \c false.
+     * @param enabled \c true to gather from a mirror padded copy of the input
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_mirror_padding(bool enabled);
+
+    /**
+     * Returns \c true if gathering from a mirror padded copy of the input is enabled.
+     */
+    virtual bool get_mirror_padding() const;
+
+    /**
+     * Returns the rectangle of the input frame read with the current settings. Every output
+     * pixel maps into the source segment, so only the part of the input it covers, folded
+     * back into the frame when reflecting, is read. Hosts may decode just this region and
+     * leave the rest of the input frame unset. The rectangle is bounded from the geometry
+     * of the source segment, so may be a pixel or so larger than the pixels actually read.
+     * @param x receives the left column
+     * @param y receives the top row
+     * @param width receives the width in pixels
+     * @param height receives the height in pixels
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr)
+     */
+    virtual std::int32_t get_source_footprint(std::uint32_t* x, std::uint32_t* y, std::uint32_t* width, std::uint32_t* height) const;
+
+    /**
+     * Sets the time #process has to complete each frame in, for real time playback. When
+     * frames are predicted to take longer, from the measured times of recent frames, they
+     * are processed at a reduced Quality that evaluates the effect for blocks of pixels
+     * rather than every pixel. Full quality is tried again from time to time so that it
+     * is restored once frames fit in the deadline. Defaults to \c 0, no deadline.
+     * @param seconds the frame deadline in seconds or \c 0 to always process at full quality
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Parameter out of range
+     */
+    virtual std::int32_t set_frame_deadline(float seconds);
+
+    /**
+     * Returns the frame deadline in seconds, \c 0 if there is none
+     */
+    virtual float get_frame_deadline() const;
+
+    /**
+     * Returns the quality the last frame processed with #process was processed at.
+     * Frames started with #submit are always processed at Quality::FULL.
+     */
+    virtual Quality get_frame_quality() const;
+
+    /**
+     * Sets the proxy factor for cheap previews when scrubbing or rendering thumbnails. The
+     * effect is evaluated on a grid with a spacing of \p factor pixels and the source
+     * coordinates of the pixels between are interpolated, except where a segment boundary
+     * passes between grid points which are evaluated exactly so seams stay sharp. The
+     * output frame is still full size and read from the full size input frame.
+     * Defaults to \c 1, every pixel evaluated.
+     * @param factor the grid spacing, one of 1, 2, 4 or 8
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Parameter out of range
+     */
+    virtual std::int32_t set_proxy_factor(std::uint32_t factor);
+
+    /**
+     * Returns the proxy factor
+     */
+    virtual std::uint32_t get_proxy_factor() const;
+
+    /**
+     * Zero fills a newly allocated frame using the same threads, and split of the frame
+     * between them, as #process so that with Affinity::NUMA each band of the frame is
+     * first touched, and so placed in memory, on the node that processes it.
+     * @param frame the frame to fill, as given to #process
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Invalid parameter (nullptr)
+     */
+    virtual std::int32_t first_touch(void* frame);
+
+    /**
+     * Sets how far ahead of the gather, in pixels, source coordinates are calculated so
+     * the source lines they reference can be prefetched. This helps when the rotated walk
+     * over the source image defeats the hardware prefetcher, typically on large frames.
+     * The distance is rounded up to a multiple of 4. Only has an effect when built with SSE2.
+     * Defaults to 0.
+     * @param distance the prefetch distance in pixels, \c 0 disables prefetching. Maximum 64.
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     *          - -2: Parameter out of range
+     */
+    virtual std::int32_t set_prefetch_distance(std::uint32_t distance);
+
+    /**
+     * Returns the prefetch distance.
+     */
+    virtual std::uint32_t get_prefetch_distance() const;
+
+    /**
+     * The output frame is written once and not read again so for frames larger than the
+     * last level cache regular stores needlessly evict the source image from the cache.
+     * Output frames of at least \p threshold bytes are written with non-temporal streaming
+     * stores that bypass the cache. Only has an effect when built with SSE2, reflecting
+     * edges, for 4 byte pixels and when each row of the output frame is 16 byte aligned.
+     * Defaults to 16MB.
+     * @param threshold the frame size in bytes, \c 0 disables streaming stores.
+     * @return
+     *          -  0: Success
+     *          - -1: Error
+     */
+    virtual std::int32_t set_streaming_threshold(std::uint32_t threshold);
+
+    /**
+     * Returns the streaming store threshold.
+     */
+    virtual std::uint32_t get_streaming_threshold() const;
+
     /**
      * Visualises the currently configured segmentation. The pure green segment is the 
      * source segment.
@@ -250,7 +636,90 @@ public:
     virtual std::int32_t visualise(void* out_frame);
 
 private:
-    void init();
+    /// An immutable snapshot of the settings and the values derived from them. Setters
+    /// publish a new snapshot and each frame processes with the one current when it started.
+    struct State {
+        float origin_x;
+        float origin_y;
+        std::uint32_t segmentation;
+        Direction segment_direction;
+        Corner preferred_corner;
+        Direction preferred_search_dir;
+        bool edge_reflect;
+        void* background_colour;
+        std::uint32_t edge_threshold;
+        float source_segment_angle;
+        std::uint32_t n_threads;
+        std::uint32_t tile_size;
+        std::uint32_t prefetch_distance;
+        std::uint32_t streaming_threshold;
+        bool auto_tuning;
+        bool remap_table;
+        float frame_deadline;
+        std::uint32_t proxy_factor;
+        Remap_rebuild remap_rebuild;
+        bool source_cache;
+        std::uint64_t output_cache;
+        bool mirror_padding;
+
+        std::uint64_t mapping_version;  ///< changes whenever the mapping of output to source pixels does
+        std::uint64_t output_key;       ///< hash of the settings the output depends on, apart from the background colour
+
+        // derived by init()
+        float origin_native_x;
+        float origin_native_y;
+        std::uint32_t n_segments;
+        float start_angle;
+        float segment_width;
+        std::int32_t pad_left;          ///< border of the mirror padded input on each side, in pixels
+        std::int32_t pad_top;
+        std::int32_t pad_right;
+        std::int32_t pad_bottom;
+        std::uint32_t footprint_x;      ///< rectangle of the input read
+        std::uint32_t footprint_y;
+        std::uint32_t footprint_width;
+        std::uint32_t footprint_height;
+#ifdef USE_SSE2
+        __m128 sse_origin_native_x;
+        __m128 sse_origin_native_y;
+        __m128 sse_start_angle;
+        __m128 sse_segment_width;
+        __m128 sse_half_segment_width;
+        __m128 sse_pad_min_x;           ///< range of source coordinates within the mirror padded input
+        __m128 sse_pad_max_x;
+        __m128 sse_pad_min_y;
+        __m128 sse_pad_max_y;
+#endif
+    };
+
+    /// Derived values of a State made out of date by a change of settings
+    static const std::uint32_t stale_origin = 1;        ///< origin in pixels
+    static const std::uint32_t stale_segments = 2;      ///< segment count and width
+    static const std::uint32_t stale_start_angle = 4;   ///< angle of the start of the source segment
+    static const std::uint32_t stale_mapping = 8;       ///< mapping of output to source pixels and any remap table of it
+    static const std::uint32_t stale_settings = 16;     ///< settings nothing is derived from
+    static const std::uint32_t stale_all = 31;
+
+    /// Returns the derived values of \p to that differ from those of \p from, 0 if the settings are the same
+    static std::uint32_t stale_values(const State& from, const State& to);
+
+    /// Calculates the values of \p state derived from its settings, only recalculating those in \p stale
+    void init(State* state, std::uint32_t stale = stale_all) const;
+
+    /// Calculates the border of the mirror padded input and the footprint of \p state from
+    /// the furthest reach of the source segment
+    void init_reach(State* state) const;
+
+    /// Calculates the range of pixels, \p start and \p length, read along an axis of \p size
+    /// pixels for source coordinates from \p first to \p last
+    static void source_range(bool reflect, float first, float last, std::int32_t size, std::uint32_t* start, std::uint32_t* length);
+
+    /// Returns the current settings
+    std::shared_ptr<const State> state() const;
+
+    /// Applies \p change to a copy of the current settings and publishes it
+    template<typename Change>
+    void update(Change change);
 
 #ifdef USE_SSE2
     /// Defines reflection information for a given point in the frame
@@ -263,27 +732,39 @@ private:
         __m128 reference_angle;          ///< positive angle to start of source segment
     };
 
-    Reflect_info calculate_reflect_info(__m128i *x, __m128i *y);
+    Reflect_info calculate_reflect_info(const State& state, __m128i *x, __m128i *y);
+
+    /// Calculates the reflection information for points at \p screen_x, \p screen_y in screen
+    /// space whose angle from the origin, \c atan2(screen_y, screen_x), is \p polar_angle
+    inline Reflect_info calculate_reflect_info(const State& state, __m128 screen_x, __m128 screen_y, __m128 polar_angle);
 
     /// Converts coordinates to screen space
+    /// @param state the settings to process with
     /// @param x x coordinate
     /// @param y y coordinate
     /// @param sx source x coordinate
     /// @param sy source y coordinate
-    void to_screen(__m128 *x, __m128 *y, __m128i *sx, __m128i *sy);
+    void to_screen(const State& state, __m128 *x, __m128 *y, __m128i *sx, __m128i *sy);
 
     /// Converts coordinates from screen space in place
+    /// @param state the settings to process with
     /// @param x x coordinate
     /// @param y y coordinate
-    void from_screen(__m128 *x, __m128 *y);
+    void from_screen(const State& state, __m128 *x, __m128 *y);
 
     /// Rotate the four coordinates from <tt>x,y</tt> to <tt>x+4,y</tt> and store results in
     /// <tt>source_x,source_y</tt>
+    /// @param state the settings to process with
     /// @param x x coordinate to start rotate from
     /// @param y y coordinate to rotate
     /// @param source_x receives the x coordiante results
     /// @param source_y receives the y coordinate results
-    inline void rotate(int x, int y, __m128 *source_x, __m128 *source_y);
+    /// @param step distance between the four x coordinates
+    /// @param region if not \c nullptr receives the region of each coordinate, see #Grid_row
+    inline void rotate(const State& state, int x, int y, __m128 *source_x, __m128 *source_y, int step = 1, __m128i* region = nullptr);
+
+    /// Rotate the four points described by \p info, see above
+    inline void rotate(const State& state, const Reflect_info& info, __m128 *source_x, __m128 *source_y, __m128i* region = nullptr);
 #else
     /// Defines reflection information for a given point in the frame
     struct Reflect_info {
@@ -295,66 +776,621 @@ private:
     };
 
     /// Calculates the reflection information for a given point.
-    /// NB: init() must have already been called.
+    /// @param state the settings to process with
     /// @param x the x coordinate
     /// @param x the y coordinate
     /// @return the reflection information for the point
-    Reflect_info calculate_reflect_info(std::uint32_t x, std::uint32_t y);
+    Reflect_info calculate_reflect_info(const State& state, std::uint32_t x, std::uint32_t y);
 
     /// Converts coordinates to screen space
+    /// @param state the settings to process with
     /// @param x x coordinate
     /// @param y y coordinate
     /// @param sx source x coordinate
     /// @param sy source y coordinate
-    void to_screen(float& x, float& y, std::uint32_t sx, std::uint32_t sy);
+    void to_screen(const State& state, float& x, float& y, std::uint32_t sx, std::uint32_t sy);
 
     /// Converts coordinates from screen space in place
+    /// @param state the settings to process with
     /// @param x x coordinate
     /// @param y y coordinate
-    void from_screen(float& x, float& y);
+    void from_screen(const State& state, float& x, float& y);
+
+    /// Rotate <tt>x,y</tt> into the source segment, without reflecting back into the image
+    /// @param state the settings to process with
+    /// @param x the x coordinate
+    /// @param y the y coordinate
+    /// @param source_x receives the source x coordinate
+    /// @param source_y receives the source y coordinate
+    /// @return the region of the point, see #Grid_row, \c 0 for the source segment itself
+    std::int32_t rotate(const State& state, std::uint32_t x, std::uint32_t y, float& source_x, float& source_y);
 #endif    
     /// A block of data to process
     struct Block {
+        const State* state;
         const std::uint8_t* in_frame;
         std::uint8_t* out_frame;
         std::uint32_t x_start;
         std::uint32_t y_start;
         std::uint32_t x_end;
         std::uint32_t y_end;
+        bool stream;
+        const std::uint32_t* table;     ///< remap table to gather through, or \c nullptr
+        std::uint32_t step;             ///< width and height of the blocks of pixels that share a source pixel
+        std::uint32_t proxy;            ///< spacing of the grid the mapping is evaluated on and interpolated between
+        bool refine;                    ///< the frame holds the pass with twice the #step, only evaluate the blocks it skipped
+        bool padded;                    ///< #in_frame points at pixel 0,0 of a mirror padded copy of the input
+        std::size_t in_stride;          ///< row stride of #in_frame when #padded or #footprint
+        bool footprint;                 ///< #in_frame holds only the source footprint, from pixel #in_x,#in_y
+        std::uint32_t in_x;             ///< left column of the input in #in_frame when #footprint
+        std::uint32_t in_y;             ///< top row of the input in #in_frame when #footprint
+        std::size_t out_offset;         ///< frame offset of the first byte of #out_frame, when it only holds a run of the block's row
 
+        /// \param state the settings to process with
         /// \param in_frame the input frame
         /// \param out_frame the output frame
         /// \param x_start start x coordinate of block to process
         /// \param y_start start y coordinate of block to process
         /// \param x_end end x coordinate of block to process (inclusive)
         /// \param y_end end y coordinate of block to process (inclusive)
-        Block(const std::uint8_t* _in_frame, std::uint8_t* _out_frame, std::uint32_t _x_start, std::uint32_t _y_start, std::uint32_t _x_end, std::uint32_t _y_end):
+        /// \param stream write the output with non-temporal streaming stores
+        Block(const State* _state, const std::uint8_t* _in_frame, std::uint8_t* _out_frame, std::uint32_t _x_start, std::uint32_t _y_start, std::uint32_t _x_end, std::uint32_t _y_end, bool _stream):
+            state(_state),
             in_frame(_in_frame),
             out_frame(_out_frame),
             x_start(_x_start),
             y_start(_y_start),
             x_end(_x_end),
-            y_end(_y_end)
+            y_end(_y_end),
+            stream(_stream),
+            table(nullptr),
+            step(1),
+            proxy(1),
+            refine(false),
+            padded(false),
+            in_stride(0),
+            footprint(false),
+            in_x(0),
+            in_y(0),
+            out_offset(0)
         {}
     };
     
+    /// The source pixel offset of every output pixel
+    struct Remap_table {
+        std::shared_ptr<const State> state;     ///< the settings the table was built for
+        std::shared_ptr<const Mapping> mapping; ///< shared with other instances through the Mapping_cache
+    };
+
+    /// Width and height in pixels of the tiles of a Source_layout
+    static const std::uint32_t source_tile = 4;
+
+    /// A static input frame copied in tiles of #source_tile x #source_tile pixels, a cache
+    /// line for 4 byte pixels, and a remap table translated to it
+    struct Source_layout {
+        std::uint64_t fingerprint[2];                   ///< of the input frame
+        std::shared_ptr<const std::uint8_t> pixels;     ///< the tiled copy, \c nullptr until the input is seen unchanged
+        std::shared_ptr<const Remap_table> table;       ///< the table #offsets were translated from
+        std::unique_ptr<std::uint32_t[]> offsets;
+    };
+
+    /// Processes the tiles of a frame as tasks on the thread pool
+    class Tile_task: public Thread_pool::Task {
+    public:
+        /// \param kaleidoscope the kaleidoscope to process with
+        /// \param state the settings to process with
+        /// \param in_frame the input frame
+        /// \param out_frame the output frame
+        /// \param tile_size the tile width and height
+        /// \param stream write the output with non-temporal streaming stores
+        Tile_task(Kaleidoscope* kaleidoscope, std::shared_ptr<const State> state, const std::uint8_t* in_frame, std::uint8_t* out_frame, std::uint32_t tile_size, bool stream);
+
+        /// Returns the number of tiles
+        std::uint32_t size() const;
+
+        /// Process tile \p index, tiles are numbered in row major order
+        virtual void run(std::uint32_t index);
+
+        /// Gathers the tiles through \p table rather than evaluating the effect
+        void set_table(std::shared_ptr<const Remap_table> table);
+
+        /// Gathers the tiles from the tiled copy of the input frame in \p source, replacing
+        /// the input frame and remap table
+        void set_source(std::shared_ptr<const Source_layout> source);
+
+        /// Evaluates the effect once per \p step x \p step block of pixels
+        void set_step(std::uint32_t step);
+
+        /// Evaluates the effect on a grid with a spacing of \p proxy pixels
+        void set_proxy(std::uint32_t proxy);
+
+        /// Refines the pass with twice the step already in the output frame
+        void set_refine(bool refine);
+
+        /// Gathers the tiles from the mirror padded copy of the input frame with pixel 0,0
+        /// at \p in_frame and a row stride of \p stride, replacing the input frame
+        void set_padded(const std::uint8_t* in_frame, std::size_t stride);
+
+        /// Gathers the tiles from the copy of the source footprint of the input frame at
+        /// \p in_frame, starting at pixel <tt>x,y</tt> with a row stride of \p stride,
+        /// replacing the input frame
+        void set_footprint(const std::uint8_t* in_frame, std::uint32_t x, std::uint32_t y, std::size_t stride);
+
+        /// Returns a block covering the whole frame
+        Block frame() const;
+
+    protected:
+        /// Returns the block covering tile \p index
+        Block block(std::uint32_t index) const;
+
+        Kaleidoscope* m_kaleidoscope;
+        std::shared_ptr<const State> m_state;
+        std::shared_ptr<const Remap_table> m_table;
+        std::shared_ptr<const Source_layout> m_source;
+        const std::uint8_t* m_in_frame;
+        std::uint8_t* m_out_frame;
+        std::uint32_t m_tile_size;
+        std::uint32_t m_n_tiles_x;
+        std::uint32_t m_n_tiles_y;
+        bool m_stream;
+        std::uint32_t m_step;
+        std::uint32_t m_proxy;
+        bool m_refine;
+        const std::uint8_t* m_padded;
+        std::size_t m_padded_stride;
+        const std::uint8_t* m_footprint;
+        std::uint32_t m_footprint_x;
+        std::uint32_t m_footprint_y;
+        std::size_t m_footprint_stride;
+    };
+
+    /// Processes the tiles of a batch of frames as tasks on the thread pool, numbered frame by
+    /// frame so that each thread's run of tasks covers whole frames
+    class Batch_task: public Tile_task {
+    public:
+        /// \param kaleidoscope the kaleidoscope to process with
+        /// \param state the settings to process with
+        /// \param in_frames the input frames
+        /// \param out_frames the output frames
+        /// \param count the number of frames
+        /// \param tile_size the tile width and height
+        /// \param stream write the output with non-temporal streaming stores
+        Batch_task(Kaleidoscope* kaleidoscope, std::shared_ptr<const State> state, const std::uint8_t* const* in_frames, std::uint8_t* const* out_frames, std::uint32_t count, std::uint32_t tile_size, bool stream):
+            Tile_task(kaleidoscope, state, nullptr, nullptr, tile_size, stream),
+            m_in_frames(in_frames),
+            m_out_frames(out_frames),
+            m_count(count)
+        {}
+
+        /// Returns the number of tiles in the batch
+        std::uint32_t size() const;
+
+        /// Process tile \p index, the tiles of frame \c n follow those of frame \c n-1
+        virtual void run(std::uint32_t index);
+
+        /// Returns a block covering the whole of frame \p index
+        Block frame(std::uint32_t index) const;
+
+    private:
+        const std::uint8_t* const* m_in_frames;
+        std::uint8_t* const* m_out_frames;
+        std::uint32_t m_count;
+    };
+
+    /// One of the views rendered by #render_views
+    struct View {
+        Kaleidoscope* kaleidoscope;
+        std::shared_ptr<const State> state;
+        std::shared_ptr<const Remap_table> table;
+        std::uint8_t* out_frame;
+        bool stream;
+        bool shared;    ///< shares the screen position and angle of each pixel with the views of the same origin
+    };
+
+    /// Processes the tiles of several views of one input frame as tasks on the thread pool,
+    /// numbered tile by tile so that the views of a tile are processed together
+    class View_task: public Tile_task {
+    public:
+        /// \param kaleidoscope the kaleidoscope of the first view, which sets the tiles
+        /// \param in_frame the input frame
+        /// \param views the views, those sharing an origin adjacent
+        /// \param groups the index of the first view of each group of views processed
+        ///        together, followed by the number of views
+        /// \param n_groups the number of groups
+        /// \param tile_size the tile width and height
+        View_task(Kaleidoscope* kaleidoscope, const std::uint8_t* in_frame, const View* views, const std::uint32_t* groups, std::uint32_t n_groups, std::uint32_t tile_size):
+            Tile_task(kaleidoscope, views[0].state, in_frame, nullptr, tile_size, false),
+            m_views(views),
+            m_groups(groups),
+            m_n_groups(n_groups)
+        {}
+
+        /// Returns the number of tiles of every group
+        std::uint32_t size() const;
+
+        /// Process tile \p index, the groups of tile \c n follow those of tile \c n-1
+        virtual void run(std::uint32_t index);
+
+        /// Process \p tile for each view of \p group
+        void process(Block tile, std::uint32_t group);
+
+    private:
+        const View* m_views;
+        const std::uint32_t* m_groups;
+        std::uint32_t m_n_groups;
+    };
+
+    /// One of the layers blended by #render_blended
+    struct Layer {
+        Kaleidoscope* kaleidoscope;
+        std::shared_ptr<const State> state;
+        std::shared_ptr<const Remap_table> table;
+        float weight;
+    };
+
+    /// Bytes of each run of pixels that the layers are rendered and blended in
+    static const std::uint32_t blend_run_bytes = 1024;
+
+    /// Processes the tiles of a blend of several layers of one input frame as tasks on the
+    /// thread pool
+    class Blend_task: public Tile_task {
+    public:
+        /// \param kaleidoscope the kaleidoscope of the first layer, which sets the tiles
+        /// \param in_frame the input frame
+        /// \param out_frame the output frame
+        /// \param layers the layers
+        /// \param count the number of layers
+        /// \param tile_size the tile width and height
+        Blend_task(Kaleidoscope* kaleidoscope, const std::uint8_t* in_frame, std::uint8_t* out_frame, const Layer* layers, std::uint32_t count, std::uint32_t tile_size):
+            Tile_task(kaleidoscope, layers[0].state, in_frame, out_frame, tile_size, false),
+            m_layers(layers),
+            m_count(count)
+        {}
+
+        /// Process tile \p index
+        virtual void run(std::uint32_t index);
+
+        /// Renders each layer of \p tile a run of pixels at a time and stores their blend
+        void blend(const Block& tile);
+
+    private:
+        const Layer* m_layers;
+        std::uint32_t m_count;
+    };
+
+    /// Zero fills the tiles of a frame as tasks on the thread pool
+    class Touch_task: public Tile_task {
+    public:
+        /// \param kaleidoscope the kaleidoscope the frame belongs to
+        /// \param state the settings to split the frame with
+        /// \param frame the frame to fill
+        /// \param tile_size the tile width and height
+        Touch_task(Kaleidoscope* kaleidoscope, std::shared_ptr<const State> state, std::uint8_t* frame, std::uint32_t tile_size):
+            Tile_task(kaleidoscope, state, nullptr, frame, tile_size, false)
+        {}
+
+        /// Fill tile \p index
+        virtual void run(std::uint32_t index);
+    };
+
+    /// Copies bands of rows of the input frame into its mirror padded copy as tasks on the thread pool
+    class Pad_task: public Thread_pool::Task {
+    public:
+        /// \param kaleidoscope the kaleidoscope to copy for
+        /// \param state the settings giving the border of the copy
+        /// \param in_frame the input frame
+        /// \param padded receives the copy, with a row stride of \p stride
+        Pad_task(Kaleidoscope* kaleidoscope, const State* state, const std::uint8_t* in_frame, std::uint8_t* padded, std::size_t stride);
+
+        /// Returns the number of bands
+        std::uint32_t size() const;
+
+        /// Copy band \p index
+        virtual void run(std::uint32_t index);
+
+    private:
+        /// Copies the pixels of row \p in that columns \p x_start to \p x_end (exclusive)
+        /// reflect back to, into \p out
+        void mirror_row(const std::uint8_t* in, std::int32_t x_start, std::int32_t x_end, std::uint8_t* out) const;
+
+        /// Number of rows in each band
+        static const std::uint32_t band_rows = 16;
+
+        Kaleidoscope* m_kaleidoscope;
+        const State* m_state;
+        const std::uint8_t* m_in_frame;
+        std::uint8_t* m_padded;
+        std::size_t m_stride;
+        std::uint32_t m_n_rows;
+    };
+
+    /// Builds the tiles of a remap table as tasks on the thread pool
+    class Remap_task: public Tile_task {
+    public:
+        /// \param kaleidoscope the kaleidoscope to build for
+        /// \param state the settings to build with
+        /// \param table receives the offsets
+        /// \param tile_size the tile width and height
+        Remap_task(Kaleidoscope* kaleidoscope, std::shared_ptr<const State> state, std::uint32_t* table, std::uint32_t tile_size):
+            Tile_task(kaleidoscope, state, nullptr, nullptr, tile_size, false),
+            m_table(table)
+        {}
+
+        /// Build tile \p index
+        virtual void run(std::uint32_t index);
+
+    private:
+        std::uint32_t* m_table;
+    };
+
+    /// Returns the remap table for \p state, building it with \p tuning if the current one
+    /// is for a different mapping. Returns \c nullptr if the frame is too large for a table.
+    std::shared_ptr<const Remap_table> remap_table(const std::shared_ptr<const State>& state, const Tuning& tuning);
+
+    /// Builds, or fetches from the Mapping_cache, the remap table for \p state with \p tuning
+    std::shared_ptr<const Remap_table> build_remap_table(const std::shared_ptr<const State>& state, const Tuning& tuning);
+
+    /// Makes \p table the current one unless a table for the same or later settings already is
+    /// @return the table to process with, the current one if it has the settings of \p table
+    std::shared_ptr<const Remap_table> publish_remap_table(const std::shared_ptr<const Remap_table>& table);
+
+    /// Returns the hash of the settings the output depends on, apart from the background colour
+    static std::uint64_t output_key(const State& state);
+
+    /// A frame rendered by #process, in the output cache
+    struct Cached_output {
+        std::uint64_t key[3];                       ///< input fingerprint and settings hash
+        std::unique_ptr<std::uint8_t[]> pixels;     ///< rows without the stride padding
+    };
+
+    /// Copies the frame cached for \p key to \p out_frame
+    /// @return \c true if the frame was cached
+    bool find_output(const std::uint64_t* key, std::uint8_t* out_frame);
+
+    /// Caches \p out_frame for \p key within a budget of \p bytes
+    void cache_output(const std::uint64_t* key, const std::uint8_t* out_frame, std::uint64_t bytes);
+
+    /// Calculates a fingerprint of the content of \p frame into \p hash
+    void fingerprint(const std::uint8_t* frame, std::uint64_t* hash) const;
+
+    /// Returns the offset in a Source_layout of the pixel at \p offset in a frame
+    std::size_t tiled_offset(std::size_t offset) const;
+
+    /// Returns the tiled copy of \p in_frame, with \p fingerprint, with \p table translated
+    /// to it, or \c nullptr if \p in_frame differs from the last frame
+    std::shared_ptr<const Source_layout> source_layout(const std::uint8_t* in_frame, const std::uint64_t* fingerprint, const std::shared_ptr<const Remap_table>& table);
+
+    /// Asks the background thread to build the remap table for \p state, starting it if needed
+    void request_remap_table(const std::shared_ptr<const State>& state);
+
+    /// Body of the background thread, building the latest requested remap table until stopped
+    void build_remap_tables();
+
+    /// Offset of output pixels without a source pixel
+    static const std::size_t no_source = SIZE_MAX;
+
+    /// Offset used in remap tables for output pixels without a source pixel
+    static const std::uint32_t table_no_source = 0xFFFFFFFF;
+
+    /// Process a block with the kernel for its settings
+    void dispatch(Block* block);
+
+    /// Process a block evaluating the effect once per Block::step x Block::step block of
+    /// pixels, for reduced quality and progressive passes
+    void process_block_reduced(Block* block);
+
+    /// Number of grid cells across a strip of a block processed in proxy mode
+    static const std::uint32_t proxy_strip = 64;
+
+    /**
+     * A row of proxy grid points with their source coordinates, before reflecting back
+     * into the image. Within a region, a segment on one side of the line of reflection,
+     * the mapping is a rotation or a reflection so coordinates can be interpolated between
+     * points of the same region. Cells with corners in different regions hold a seam.
+     */
+    struct Grid_row {
+        float x[proxy_strip + 4];
+        float y[proxy_strip + 4];
+        std::int32_t region[proxy_strip + 4];
+    };
+
+    /// Evaluate the \p n grid points <tt>x,y</tt> to <tt>x+(n-1)*step,y</tt> into \p row
+    void evaluate_grid_row(const State& state, std::uint32_t x, std::uint32_t y, std::uint32_t step, std::uint32_t n, Grid_row* row);
+
+    /// Process a block evaluating the effect on a grid with a spacing of Block::proxy pixels,
+    /// interpolating the source coordinates between grid points except in cells with seams
+    void process_block_proxy(Block* block);
+
+    /// Process pixel row \p y of a strip of proxy grid cells starting at \p grid_x
+    /// @param left_x the source x coordinate of the left edge of each cell on the row
+    /// @param left_y the source y coordinate of the left edge of each cell on the row
+    /// @param dx the change in source x coordinate per pixel across each cell
+    /// @param dy the change in source y coordinate per pixel across each cell
+    /// @param seam \c true for the cells to evaluate every pixel of
+    void process_proxy_row(Block* block, std::uint32_t grid_x, std::uint32_t x_start, std::uint32_t x_end, std::uint32_t y,
+        const float* left_x, const float* left_y, const float* dx, const float* dy, const bool* seam);
+
+    /// Process a block by gathering through its remap table
+    void process_block_table(Block* block);
+
+    /// Copy the pixel at \p offset in \p in to \p out, or the background colour if \p offset
+    /// is #no_source
+    inline void copy_pixel(const State& state, const std::uint8_t* in, std::size_t offset, std::uint8_t* out);
+
+    /// Returns the byte offset of pixel <tt>x,y</tt> from the start of a frame
+    std::size_t offset(std::uint32_t x, std::uint32_t y) const;
+
+    /// Returns the pointer to output pixel <tt>x,y</tt> of \p block
+    std::uint8_t* output(const Block& block, std::uint32_t x, std::uint32_t y) const;
+
+    /// Returns the offset of source pixel <tt>x,y</tt> in the input of \p block
+    std::size_t input_offset(const Block& block, std::uint32_t x, std::uint32_t y) const;
+
+    /// A frame started with #submit, reused for later frames once it has been waited for
+    struct In_flight {
+        std::uint64_t ticket;
+        Thread_pool::Job job;
+        Tile_task task;
+
+        /// \param _task the tiles of the frame
+        explicit In_flight(const Tile_task& _task):
+            ticket(0),
+            task(_task)
+        {}
+    };
+
+    /// Processes the tiles of \p task, as a single block if \p n_threads is 1, and records
+    /// the busy time of each thread
+    void run_frame(Tile_task* task, std::uint32_t n_threads);
+
+    /// The refinement reached by #process_progressive
+    struct Progress {
+        std::shared_ptr<const State> state;     ///< the settings being refined
+        const void* in_frame;
+        void* out_frame;
+        std::uint32_t step;                     ///< block size of the last pass, 0 before the first
+
+        Progress():
+            in_frame(nullptr),
+            out_frame(nullptr),
+            step(0)
+        {}
+    };
+
+    /// Block size of the first progressive pass
+    static const std::uint32_t progressive_step = 8;
+
+    /// Frames submitted with fewer tiles than this per thread are processed by a single thread
+    static const std::uint32_t async_tiles_per_thread = 16;
+
+    /// Returns a job to run a frame on, reusing one from a completed frame if possible
+    std::unique_ptr<Thread_pool::Job> acquire_job();
+
+    /// Returns \p job for reuse once its frame has completed
+    void release_job(std::unique_ptr<Thread_pool::Job> job);
+
+    /// Returns the key the online tuner and deadline governor measure frame times for
+    static std::uint64_t cost_key(const State& state);
+
+    /// Returns the thread count and tile size to process the next frame with under \p state
+    /// @param online \c true to take the online tuner's choice if it is enabled
+    Tuning tuning(const State& state, bool online);
+
+    /// Returns the number of threads to process with for the \p threading setting, limited
+    /// by the process wide concurrency
+    static std::uint32_t thread_count(std::uint32_t threading);
+
     /// Process a block
     void process_block(Block *block);
 
+    /// Maximum distance, in pixels, that source coordinates can be calculated ahead of the gather
+    static const std::uint32_t max_prefetch_distance = 64;
+
+#ifdef USE_SSE2
+    /// Process a block prefetching source lines State::prefetch_distance pixels ahead
+    void process_block_prefetch(Block* block);
+
+    /// Calculate the source image coordinates for the four pixels from <tt>x,y</tt> to <tt>x+4,y</tt>
+    /// reflecting back into the image if necessary
+    /// @param state the settings to process with
+    /// @param x x coordinate to start from
+    /// @param y y coordinate
+    /// @param source_xi receives the source x coordinates
+    /// @param source_yi receives the source y coordinates
+    /// @param step distance between the four x coordinates
+    inline void source_coords(const State& state, int x, int y, __m128i* source_xi, __m128i* source_yi, int step = 1);
+
+    /// Reflect four source coordinates back into the image and convert them to pixels
+    inline void reflect_coords(__m128 source_x, __m128 source_y, __m128i* source_xi, __m128i* source_yi);
+
+    /// As #source_coords for \p block, leaving the coordinates outside the image for a
+    /// mirror padded input
+    inline void block_coords(const Block& block, int x, int y, __m128i* source_xi, __m128i* source_yi);
+
+    /// Converts four source coordinates in the frame to coordinates in the copy of the source
+    /// footprint that is the input of \p block
+    inline void footprint_coords(const Block& block, __m128i* source_xi, __m128i* source_yi);
+
+    /// Returns the source pixel <tt>x,y</tt> of \p in with a row stride of \p stride, \p x and
+    /// \p y may be negative in a mirror padded input
+    inline const std::uint8_t* source_pixel(const std::uint8_t* in, std::size_t stride, std::int32_t x, std::int32_t y) const;
+
+    /// Prefetch the four source pixels at \p source_xi, \p source_yi
+    inline void prefetch(const std::uint8_t* in, std::size_t stride, __m128i* source_xi, __m128i* source_yi);
+
+    /// Copy the four source pixels at \p source_xi, \p source_yi from \p in, with a row stride
+    /// of \p stride, to consecutive pixels in \p out
+    inline void gather(const std::uint8_t* in, std::size_t stride, __m128i* source_xi, __m128i* source_yi, std::uint8_t* out);
+
+    /// As #gather but writes the 4 byte pixels to the 16 byte aligned \p out with a non-temporal store
+    inline void gather_stream(const std::uint8_t* in, std::size_t stride, __m128i* source_xi, __m128i* source_yi, std::uint8_t* out);
+#endif
+
+    /// Returns the coordinate in <tt>[0, size)</tt> that \p v reflects back to, as
+    /// #reflect_coords does for the pixel containing it
+    static std::int32_t mirror(std::int32_t v, std::int32_t size);
+
+    /// Copies \p in_frame into \p padded, a mirror padded copy with the border of \p state and
+    /// a row stride of \p stride, using \p n_threads
+    void pad_frame(const State& state, const std::uint8_t* in_frame, std::uint8_t* padded, std::size_t stride, std::uint32_t n_threads);
+
+    /// Copies the footprint of \p state in \p in_frame into \p copy, its rows packed
+    void copy_footprint(const State& state, const std::uint8_t* in_frame, std::vector<std::uint8_t>* copy);
+
+    /// Returns a buffer for a copy of the input, mirror padded or of its footprint, reusing
+    /// one from an earlier frame if possible
+    std::vector<std::uint8_t> acquire_copy();
+
+    /// Returns \p copy for reuse by later frames
+    void release_copy(std::vector<std::uint8_t> copy);
+
+    /// Returns \c true if \p out_frame should be written with streaming stores under \p state
+    bool use_streaming_stores(const State& state, const void* out_frame) const;
+
     /// Copy pixel <tt>source_x,source_y</tt> from \p in to \p out using the background colour
     /// if the pixel is out of range
+    /// @param state the settings to process with
+    /// @param block the block whose input to copy from
     /// @param x x coordinate to copy 
     /// @param y y coordinate to copy
-    /// @param in the first pixel in the source image
     /// @param out destination
-    void process_bg(float x, float y, const std::uint8_t* in, std::uint8_t* out);
+    void process_bg(const State& state, const Block& block, float x, float y, std::uint8_t* out);
+
+    /// Returns the offset in the input of \p block of the source pixel nearest <tt>x,y</tt>
+    /// when using the background colour, #no_source if out of range
+    std::size_t bg_offset(const State& state, const Block& block, float x, float y);
+
+#ifdef USE_SSE2
+    /// Calculate the source pixel offsets, in the input of \p block, of the four pixels
+    /// <tt>x,y</tt> to <tt>x+3*step,y</tt>, #no_source for pixels using the background colour
+    void source_offsets(const State& state, const Block& block, int x, int y, std::size_t* offsets, int step = 1);
+#else
+    /// Calculate the source pixel offset, in the input of \p block, of pixel <tt>x,y</tt>
+    std::size_t source_offset(const State& state, const Block& block, std::uint32_t x, std::uint32_t y);
+
+    /// Returns the offset in the input of \p block of the source pixel at <tt>x,y</tt>,
+    /// reflecting back into the image or #no_source for the background colour as set in \p state
+    std::size_t reflect_offset(const State& state, const Block& block, float x, float y);
+#endif
 
 
 #ifdef USE_SSE2
     // Process a block using background colour copy
     void process_block_bg(Block* block);
+
+    /// Process \p block for each of \p count views with the same origin, calculating the
+    /// screen position and angle of each pixel once for them all
+    void process_block_views(const Block& block, const View* views, std::uint32_t count);
 #endif
 
+    /// Implements IKaleidoscope::process_views
+    static std::int32_t render_views(IKaleidoscope* const* views, const void* in_frame, void* const* out_frames, std::uint32_t count);
+
+    /// Implements IKaleidoscope::process_blended
+    static std::int32_t render_blended(IKaleidoscope* const* layers, const float* weights, const void* in_frame, void* out_frame, std::uint32_t count);
+
+    friend class IKaleidoscope;
+
     std::uint8_t *lookup(std::uint8_t *p, std::uint32_t x, std::uint32_t y);
 
     const std::uint8_t* lookup(const std::uint8_t* p, std::uint32_t x, std::uint32_t y);
@@ -368,37 +1404,48 @@ private:
 
     float m_aspect;
 
-    float m_origin_x;
-    float m_origin_y;
-    float m_origin_native_x;
-    float m_origin_native_y;
+    std::shared_ptr<const State> m_state;   ///< only accessed with std::atomic_load and std::atomic_store
+    std::mutex m_state_mutex;               ///< serialises updates to #m_state
+    std::uint64_t m_mapping_version;        ///< last State::mapping_version, guarded by #m_state_mutex
+
+    Online_tuner m_tuner;
+    Deadline_governor m_governor;
+    std::atomic<Quality> m_frame_quality;   ///< quality of the last frame processed
 
-    std::uint32_t m_segmentation;
-    Direction m_segment_direction;
+    std::shared_ptr<const Remap_table> m_remap;     ///< only accessed with std::atomic_load and std::atomic_store
+    std::mutex m_remap_mutex;                       ///< serialises publishing remap tables
+    std::atomic<float> m_remap_build_time;
+    std::atomic<bool> m_frame_stale;                ///< the last frame processed used the table of earlier settings
 
-    Corner m_preferred_corner;
-    Direction m_preferred_search_dir;
+    std::shared_ptr<const Source_layout> m_source;  ///< only accessed with std::atomic_load and std::atomic_store
+    std::mutex m_source_mutex;                      ///< serialises updates to #m_source
 
-    bool m_edge_reflect;
+    std::mutex m_output_mutex;                      ///< guards #m_outputs
+    std::list<Cached_output> m_outputs;             ///< most recently used first
+    std::atomic<std::uint64_t> m_output_hits;
+    std::atomic<std::uint64_t> m_output_misses;
 
-    void* m_background_colour;
-    std::uint32_t m_edge_threshold;
+    std::mutex m_builder_mutex;                     ///< guards the members used by the background thread
+    std::condition_variable m_builder_wake;
+    std::shared_ptr<const State> m_remap_request;   ///< settings of the table to build in the background, until built
+    bool m_builder_stop;
+    std::thread m_builder;                          ///< builds remap tables in the background, started when first needed
 
-    float m_source_segment_angle;
+    std::mutex m_progress_mutex;            ///< serialises progressive passes
+    Progress m_progress;
 
-    std::uint32_t m_n_segments;
-    float m_start_angle;
-    float m_segment_width;
+    mutable std::mutex m_busy_mutex;
+    std::vector<float> m_busy_times;
 
-    std::uint32_t m_n_threads;
+    std::mutex m_in_flight_mutex;
+    std::vector<std::unique_ptr<In_flight>> m_in_flight;            ///< frames not yet waited for, in submission order
+    std::vector<std::unique_ptr<In_flight>> m_free_frames;          ///< completed frames for reuse
+    std::vector<std::unique_ptr<Thread_pool::Job>> m_free_jobs;     ///< jobs of completed frames for reuse
+    std::vector<std::vector<std::uint8_t>> m_free_copies;           ///< copies of the input of completed frames for reuse
+    std::uint64_t m_next_ticket;
 
 #ifdef USE_SSE2
     __m128 m_sse_aspect;
-    __m128 m_sse_origin_native_x;
-    __m128 m_sse_origin_native_y;
-    __m128 m_sse_start_angle;
-    __m128 m_sse_segment_width;
-    __m128 m_sse_half_segment_width;
     __m128 m_sse_ps_0;
     __m128 m_sse_ps_1;
     __m128 m_sse_ps_2;
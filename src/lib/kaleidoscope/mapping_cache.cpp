@@ -0,0 +1,298 @@
+#include "mapping_cache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <iomanip>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace libkaleidoscope {
+
+/// Version of the disk cache file format, files of other versions are ignored. Bumped when
+/// the mapping itself changes: 2 maps the origin pixel to itself rather than a frame corner
+static const std::uint32_t file_version = 2;
+/// Bytes before the offsets in a disk cache file, keeping them aligned when mapped
+static const std::size_t file_header_size = 128;
+
+/// Identifies the mapping held by a disk cache file
+struct File_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;   ///< 0x01020304 as written, to ignore files from other architectures
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t stride;
+    std::uint32_t pixel_size;
+    float origin_x;
+    float origin_y;
+    std::uint32_t n_segments;
+    float start_angle;
+    std::uint32_t reflect;
+    std::uint32_t threshold;
+    std::uint32_t sse;
+    std::uint32_t reserved;
+    std::uint64_t n_offsets;
+};
+
+static_assert(sizeof(File_header) <= file_header_size, "disk cache header too large");
+
+static File_header file_header(const Mapping_cache::Key& key)
+{
+    File_header header;
+    // zeroed so the padding hashes and compares the same in every process
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "kalmap\0\0", sizeof(header.magic));
+    header.version = file_version;
+    header.byte_order = 0x01020304;
+    header.width = std::get<0>(key);
+    header.height = std::get<1>(key);
+    header.stride = std::get<2>(key);
+    header.pixel_size = std::get<3>(key);
+    header.origin_x = std::get<4>(key);
+    header.origin_y = std::get<5>(key);
+    header.n_segments = std::get<6>(key);
+    header.start_angle = std::get<7>(key);
+    header.reflect = std::get<8>(key);
+    header.threshold = std::get<9>(key);
+    header.sse = std::get<10>(key);
+    header.n_offsets = static_cast<std::uint64_t>(header.width) * header.height;
+    return header;
+}
+
+/// Offset of pixels using the background colour, as Kaleidoscope::table_no_source
+static const std::uint32_t no_source_offset = 0xFFFFFFFF;
+
+/// Returns \c true if every offset in \p offsets, read from the file for \p header, is
+/// #no_source_offset or addresses a whole pixel of the frame
+static bool valid_offsets(const File_header& header, const std::uint32_t* offsets)
+{
+    const std::uint64_t frame_size = static_cast<std::uint64_t>(header.stride) * header.height;
+    for (std::uint64_t i = 0; i < header.n_offsets; ++i) {
+        if (offsets[i] != no_source_offset && offsets[i] + static_cast<std::uint64_t>(header.pixel_size) > frame_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Returns the path of the disk cache file for \p header, named by a hash of it
+static std::string file_path(const std::string& directory, const File_header& header)
+{
+    // FNV-1a
+    std::uint64_t hash = 14695981039346656037ull;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&header);
+    for (std::size_t i = 0; i < sizeof(header); ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    std::stringstream ss;
+    ss << directory;
+    if (directory.back() != '/' && directory.back() != '\\') {
+        ss << '/';
+    }
+    ss << "kaleidoscope-" << std::hex << std::setw(16) << std::setfill('0') << hash << ".map";
+    return ss.str();
+}
+
+Mapping::~Mapping()
+{
+#ifndef _WIN32
+    if (region) {
+        munmap(region, region_size);
+    }
+#endif
+}
+
+Mapping_cache& Mapping_cache::instance()
+{
+    static Mapping_cache cache;
+    return cache;
+}
+
+Mapping_cache::Mapping_cache():
+m_budget(default_budget),
+m_size(0)
+{
+    const char* directory = std::getenv("KALEIDOSCOPE_MAPPING_CACHE");
+    if (directory) {
+        m_directory = directory;
+    }
+}
+
+std::shared_ptr<const Mapping> Mapping_cache::find(const Key& key)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto entry = m_entries.find(key);
+        if (entry != m_entries.end()) {
+            m_uses.splice(m_uses.begin(), m_uses, entry->second.use);
+            return entry->second.mapping;
+        }
+    }
+    std::shared_ptr<const Mapping> mapping(load(key));
+    if (!mapping) {
+        return nullptr;
+    }
+    return add(key, mapping);
+}
+
+std::shared_ptr<const Mapping> Mapping_cache::insert(const Key& key, std::shared_ptr<const Mapping> mapping)
+{
+    store(key, *mapping);
+    return add(key, mapping);
+}
+
+std::shared_ptr<const Mapping> Mapping_cache::add(const Key& key, std::shared_ptr<const Mapping> mapping)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(key);
+    if (entry != m_entries.end()) {
+        m_uses.splice(m_uses.begin(), m_uses, entry->second.use);
+        return entry->second.mapping;
+    }
+    if (mapping->size > m_budget) {
+        return mapping;
+    }
+    m_uses.push_front(key);
+    Entry added;
+    added.mapping = mapping;
+    added.use = m_uses.begin();
+    m_entries[key] = added;
+    m_size += mapping->size;
+    evict();
+    return mapping;
+}
+
+void Mapping_cache::set_budget(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_budget = bytes;
+    evict();
+}
+
+std::size_t Mapping_cache::get_budget() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_budget;
+}
+
+std::size_t Mapping_cache::get_size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+void Mapping_cache::set_directory(const std::string& directory)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_directory = directory;
+}
+
+std::string Mapping_cache::get_directory() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_directory;
+}
+
+void Mapping_cache::evict()
+{
+    while (m_size > m_budget) {
+        auto entry = m_entries.find(m_uses.back());
+        m_size -= entry->second.mapping->size;
+        m_entries.erase(entry);
+        m_uses.pop_back();
+    }
+}
+
+std::shared_ptr<const Mapping> Mapping_cache::load(const Key& key) const
+{
+    std::string directory(get_directory());
+    if (directory.empty()) {
+        return nullptr;
+    }
+    File_header header(file_header(key));
+    std::string path(file_path(directory, header));
+    std::size_t size = static_cast<std::size_t>(header.n_offsets) * sizeof(std::uint32_t);
+    std::shared_ptr<Mapping> mapping(new Mapping());
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) != file_header_size + size) {
+        close(fd);
+        return nullptr;
+    }
+    // shared so every process using the file shares its pages
+    void* region = mmap(nullptr, file_header_size + size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        return nullptr;
+    }
+    mapping->region = region;
+    mapping->region_size = file_header_size + size;
+    if (std::memcmp(region, &header, sizeof(header)) != 0) {
+        return nullptr;
+    }
+    mapping->offsets = reinterpret_cast<const std::uint32_t*>(static_cast<const char*>(region) + file_header_size);
+#else
+    std::ifstream file(path, std::ios::binary);
+    char stored[file_header_size];
+    if (!file.read(stored, file_header_size) || std::memcmp(stored, &header, sizeof(header)) != 0) {
+        return nullptr;
+    }
+    mapping->data.reset(new std::uint32_t[header.n_offsets]);
+    if (!file.read(reinterpret_cast<char*>(mapping->data.get()), size)) {
+        return nullptr;
+    }
+    mapping->offsets = mapping->data.get();
+#endif
+    // the directory is shared between processes, so a damaged or altered file is rejected
+    // rather than gathering from outside the frame
+    if (!valid_offsets(header, mapping->offsets)) {
+        return nullptr;
+    }
+    mapping->size = size;
+    return mapping;
+}
+
+void Mapping_cache::store(const Key& key, const Mapping& mapping) const
+{
+    std::string directory(get_directory());
+    if (directory.empty()) {
+        return;
+    }
+    File_header header(file_header(key));
+    std::string path(file_path(directory, header));
+    // written under a unique name and renamed over any unreadable file, so readers never
+    // see a partial file and processes mapping the old one keep it
+    std::stringstream ss;
+    ss << path << "." << std::hex << std::random_device()() << ".tmp";
+    std::string temp(ss.str());
+    {
+        std::ofstream file(temp, std::ios::binary);
+        char padding[file_header_size] = {};
+        std::memcpy(padding, &header, sizeof(header));
+        file.write(padding, file_header_size);
+        file.write(reinterpret_cast<const char*>(mapping.offsets), mapping.size);
+        file.close();
+        if (!file) {
+            std::remove(temp.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+    }
+}
+
+}
@@ -0,0 +1,119 @@
+#ifndef LIBKALEIDOSCOPE_MAPPING_CACHE_H
+#define LIBKALEIDOSCOPE_MAPPING_CACHE_H 1
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+namespace libkaleidoscope {
+
+/// The source offset of every output pixel of a frame, built in memory or mapped from a
+/// file of the disk cache
+struct Mapping {
+    const std::uint32_t* offsets;           ///< into #data or #region
+    std::size_t size;                       ///< bytes used by #offsets
+    std::unique_ptr<std::uint32_t[]> data;  ///< offsets built in memory
+    void* region;                           ///< file mapped read only, or \c nullptr
+    std::size_t region_size;
+
+    Mapping():
+        offsets(nullptr),
+        size(0),
+        region(nullptr),
+        region_size(0)
+    {}
+
+    ~Mapping();
+
+private:
+    Mapping(const Mapping&);
+    Mapping& operator=(const Mapping&);
+};
+
+/**
+ * The process wide cache of mappings, shared by every kaleidoscope with the same frame
+ * geometry and mapping settings. The least recently used mappings are dropped from the
+ * cache when it grows over its budget, kaleidoscopes still using them keep their own
+ * reference.
+ * When a directory is set mappings are also written there, so later processes map them
+ * read only instead of building them and processes on the same machine share the pages.
+ * The directory is taken from the \c KALEIDOSCOPE_MAPPING_CACHE environment variable
+ * when first used.
+ */
+class Mapping_cache {
+public:
+    /// width, height, stride, pixel size, origin x, origin y, segment count, start angle,
+    /// reflect edges, edge threshold and whether the mapping was built with SSE2
+    typedef std::tuple<std::uint32_t, std::uint32_t, std::uint32_t, std::uint32_t, float, float, std::uint32_t, float, bool, std::uint32_t, bool> Key;
+
+    /// Default budget in bytes, enough for eight 1080p mappings
+    static const std::size_t default_budget = 64 * 1024 * 1024;
+
+    /// Returns the process wide cache
+    static Mapping_cache& instance();
+
+    /// Returns the mapping for \p key, marking it most recently used, from memory or else
+    /// the disk cache, or \c nullptr if not cached
+    std::shared_ptr<const Mapping> find(const Key& key);
+
+    /// Adds \p mapping for \p key, writing it to the disk cache, and drops least recently
+    /// used mappings over the budget.
+    /// @return the cached mapping for \p key, which is an earlier one if another thread
+    ///         added it first, or \p mapping if it is larger than the whole budget
+    std::shared_ptr<const Mapping> insert(const Key& key, std::shared_ptr<const Mapping> mapping);
+
+    /// Sets the budget in bytes, dropping least recently used mappings over it
+    void set_budget(std::size_t bytes);
+
+    /// Returns the budget in bytes
+    std::size_t get_budget() const;
+
+    /// Returns the bytes used by the cached mappings
+    std::size_t get_size() const;
+
+    /// Sets the directory of the disk cache, empty to disable it
+    void set_directory(const std::string& directory);
+
+    /// Returns the directory of the disk cache, empty if disabled
+    std::string get_directory() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const Mapping> mapping;
+        std::list<Key>::iterator use;   ///< position in #m_uses
+    };
+
+    Mapping_cache();
+
+    Mapping_cache(const Mapping_cache&);
+    Mapping_cache& operator=(const Mapping_cache&);
+
+    /// Adds \p mapping for \p key without writing it to the disk cache
+    std::shared_ptr<const Mapping> add(const Key& key, std::shared_ptr<const Mapping> mapping);
+
+    /// Drops least recently used mappings until the cache fits in its budget
+    void evict();
+
+    /// Returns the mapping for \p key from the disk cache, or \c nullptr if it has none or
+    /// any of its offsets is outside the frame
+    std::shared_ptr<const Mapping> load(const Key& key) const;
+
+    /// Writes \p mapping for \p key to the disk cache
+    void store(const Key& key, const Mapping& mapping) const;
+
+    mutable std::mutex m_mutex;
+    std::size_t m_budget;
+    std::size_t m_size;
+    std::map<Key, Entry> m_entries;
+    std::list<Key> m_uses;          ///< keys of #m_entries, most recently used first
+    std::string m_directory;
+};
+
+}
+
+#endif
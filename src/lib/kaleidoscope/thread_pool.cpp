@@ -0,0 +1,429 @@
+#include "thread_pool.h"
+
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if !defined(NO_SSE2) && (defined(__SSE2__) || _M_IX86_FP == 2 || _M_X64 == 100)
+#include <emmintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() std::this_thread::yield()
+#endif
+
+namespace libkaleidoscope {
+
+/// Number of times a parked worker polls for a new job before sleeping
+static const std::uint32_t spin_count = 4000;
+
+/// Parses a cpu or node list such as "0-3,8-11"
+static std::vector<std::int32_t> parse_list(const std::string& list)
+{
+    std::vector<std::int32_t> result;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        std::int32_t first(0);
+        std::int32_t last(0);
+        char dash(0);
+        std::stringstream is(item);
+        is >> first;
+        if (is.fail()) {
+            continue;
+        }
+        last = first;
+        if (is >> dash >> last && dash != '-') {
+            last = first;
+        }
+        for (std::int32_t i = first; i <= last; ++i) {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+/// Returns the cpus, that the process can run on, of each NUMA node
+static std::vector<std::vector<std::int32_t>> detect_topology()
+{
+    std::vector<std::vector<std::int32_t>> nodes;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        for (std::int32_t i = 0; i < CPU_SETSIZE; ++i) {
+            CPU_SET(i, &allowed);
+        }
+    }
+    std::string online;
+    std::ifstream(std::string("/sys/devices/system/node/online")) >> online;
+    for (auto node : parse_list(online)) {
+        std::string cpulist;
+        std::ifstream(std::string("/sys/devices/system/node/node") + std::to_string(node) + "/cpulist") >> cpulist;
+        std::vector<std::int32_t> cpus;
+        for (auto cpu : parse_list(cpulist)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+        if (!cpus.empty()) {
+            nodes.push_back(cpus);
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        nodes.push_back(std::vector<std::int32_t>());
+        for (std::uint32_t i = 0; i < std::max(std::thread::hardware_concurrency(), 1u); ++i) {
+            nodes.back().push_back(static_cast<std::int32_t>(i));
+        }
+    }
+    return nodes;
+}
+
+Thread_pool::Job::Job():
+m_task(nullptr),
+m_n_slots(0),
+m_n_nodes(1),
+m_capacity(0),
+m_remaining(0),
+m_active(0),
+m_exhausted(true)
+{
+}
+
+std::uint32_t Thread_pool::Job::slot_node(std::uint32_t slot) const
+{
+    if (m_n_nodes == 1) {
+        return 0;
+    }
+    // the calling thread isn't on any particular node
+    return slot == 0 ? m_n_nodes : (slot - 1) % m_n_nodes;
+}
+
+const std::vector<double>& Thread_pool::Job::busy_times() const
+{
+    return m_busy;
+}
+
+Thread_pool& Thread_pool::instance()
+{
+    // the calling thread works too
+    static Thread_pool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    return pool;
+}
+
+Thread_pool::Thread_pool(std::uint32_t n_workers):
+m_n_workers(0),
+m_affinity(IKaleidoscope::Affinity::NONE),
+m_n_nodes(1),
+m_topology(detect_topology()),
+m_generation(0),
+m_next_job(0),
+m_stop(false),
+m_spin_count(0)
+{
+    resize(n_workers);
+}
+
+Thread_pool::~Thread_pool()
+{
+    stop();
+}
+
+void Thread_pool::resize(std::uint32_t n_workers)
+{
+    std::lock_guard<std::mutex> resize_lock(m_resize_mutex);
+    if (n_workers != m_workers.size()) {
+        restart(n_workers, m_affinity);
+    }
+}
+
+void Thread_pool::set_affinity(IKaleidoscope::Affinity affinity)
+{
+    std::lock_guard<std::mutex> resize_lock(m_resize_mutex);
+    if (affinity != m_affinity) {
+        restart(static_cast<std::uint32_t>(m_workers.size()), affinity);
+    }
+}
+
+IKaleidoscope::Affinity Thread_pool::get_affinity() const
+{
+    return m_affinity;
+}
+
+void Thread_pool::restart(std::uint32_t n_workers, IKaleidoscope::Affinity affinity)
+{
+    // jobs in progress are finished by the threads waiting on them
+    stop();
+    std::uint32_t n_nodes = affinity == IKaleidoscope::Affinity::NUMA ? static_cast<std::uint32_t>(m_topology.size()) : 1;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = false;
+        // spinning only helps when every thread has a core to itself, otherwise it steals
+        // time from the threads doing the work
+        m_spin_count = n_workers < std::thread::hardware_concurrency() ? spin_count : 0;
+    }
+    std::vector<std::int32_t> cpus;
+    for (auto& node : m_topology) {
+        cpus.insert(cpus.end(), node.begin(), node.end());
+    }
+    for (std::uint32_t i = 0; i < n_workers; ++i) {
+        switch (affinity) {
+        case IKaleidoscope::Affinity::NONE:
+            m_workers.emplace_back(&Thread_pool::worker, this, 0, -1);
+            break;
+        case IKaleidoscope::Affinity::CORE:
+            m_workers.emplace_back(&Thread_pool::worker, this, 0, cpus[i % cpus.size()]);
+            break;
+        case IKaleidoscope::Affinity::NUMA: {
+            // spread the workers evenly over the nodes
+            const std::vector<std::int32_t>& node = m_topology[i % n_nodes];
+            m_workers.emplace_back(&Thread_pool::worker, this, i % n_nodes, node[(i / n_nodes) % node.size()]);
+            break;
+        }
+        }
+    }
+    m_n_workers = n_workers;
+    m_n_nodes = n_nodes;
+    m_affinity = affinity;
+}
+
+std::uint32_t Thread_pool::size() const
+{
+    return m_n_workers;
+}
+
+void Thread_pool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& w : m_workers) {
+        w.join();
+    }
+    m_workers.clear();
+    m_n_workers = 0;
+}
+
+void Thread_pool::run(Job* job, Task* task, std::uint32_t n_tasks, std::uint32_t n_threads)
+{
+    deal(job, task, n_tasks, std::max(std::min(n_threads, size() + 1), 1u), true);
+    wait(job);
+}
+
+void Thread_pool::start(Job* job, Task* task, std::uint32_t n_tasks, std::uint32_t n_threads)
+{
+    // slot 0 is left for whoever waits on the job
+    deal(job, task, n_tasks, std::min(std::max(n_threads, 1u), size()) + 1, false);
+}
+
+void Thread_pool::wait(Job* job)
+{
+    // help with whatever the workers haven't yet taken
+    execute(job, 0);
+
+    if (job->m_n_slots > 1) {
+        for (std::uint32_t i = 0; i < m_spin_count && job->m_remaining != 0; ++i) {
+            cpu_relax();
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        job->m_exhausted = true;
+        m_done.wait(lock, [job] { return job->m_remaining == 0 && job->m_active == 0; });
+        m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), job));
+    }
+}
+
+void Thread_pool::deal(Job* job, Task* task, std::uint32_t n_tasks, std::uint32_t n_slots, bool caller)
+{
+    if (job->m_capacity < n_slots) {
+        job->m_ranges.reset(new Job::Range[n_slots]);
+        job->m_capacity = n_slots;
+    }
+    job->m_task = task;
+    job->m_n_slots = n_slots;
+    job->m_n_nodes = n_slots > 2 ? std::min(m_n_nodes.load(), n_slots - 1) : 1;
+    if (job->m_n_nodes == 1) {
+        // deal out contiguous runs of tasks, idle threads steal from busy ones
+        std::uint32_t first = caller || n_slots == 1 ? 0 : 1;
+        std::uint32_t n_dealt = n_slots - first;
+        job->m_ranges[0].range = pack(0, 0);
+        for (std::uint32_t i = 0; i < n_dealt; ++i) {
+            job->m_ranges[first + i].range = pack(static_cast<std::uint32_t>(std::uint64_t(n_tasks) * i / n_dealt),
+                                                  static_cast<std::uint32_t>(std::uint64_t(n_tasks) * (i + 1) / n_dealt));
+        }
+        job->m_joined.assign(1, 1);
+    } else {
+        // deal each node a contiguous band split between its threads, the calling thread
+        // isn't on any particular node so it only steals
+        std::uint32_t n_dealt = n_slots - 1;
+        std::uint32_t i = 0;
+        job->m_ranges[0].range = pack(0, 0);
+        for (std::uint32_t node = 0; node < job->m_n_nodes; ++node) {
+            for (std::uint32_t slot = node + 1; slot < n_slots; slot += job->m_n_nodes, ++i) {
+                job->m_ranges[slot].range = pack(static_cast<std::uint32_t>(std::uint64_t(n_tasks) * i / n_dealt),
+                                                 static_cast<std::uint32_t>(std::uint64_t(n_tasks) * (i + 1) / n_dealt));
+            }
+        }
+        job->m_joined.assign(job->m_n_nodes, 0);
+    }
+    job->m_busy.assign(n_slots, 0);
+    job->m_remaining = n_tasks;
+    job->m_active = 0;
+    job->m_exhausted = false;
+
+    if (n_slots > 1) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(job);
+            m_generation++;
+        }
+        m_wake.notify_all();
+    }
+}
+
+std::uint64_t Thread_pool::pack(std::uint32_t begin, std::uint32_t end)
+{
+    return (std::uint64_t(end) << 32) | begin;
+}
+
+bool Thread_pool::pop(Job* job, std::uint32_t slot, std::uint32_t* index)
+{
+    std::atomic<std::uint64_t>& range = job->m_ranges[slot].range;
+    std::uint64_t v = range;
+    while (true) {
+        std::uint32_t begin = static_cast<std::uint32_t>(v);
+        std::uint32_t end = static_cast<std::uint32_t>(v >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        if (range.compare_exchange_weak(v, pack(begin + 1, end))) {
+            *index = begin;
+            return true;
+        }
+    }
+}
+
+bool Thread_pool::steal(Job* job, std::uint32_t slot, std::uint32_t* index)
+{
+    std::uint32_t n_slots = job->m_n_slots;
+    std::uint32_t node = job->slot_node(slot);
+    for (std::uint32_t i = 1; i < n_slots; ++i) {
+        std::uint32_t victim = (slot + i) % n_slots;
+        if (job->slot_node(victim) == node && steal_from(job, victim, slot, index)) {
+            return true;
+        }
+    }
+    for (std::uint32_t i = 1; i < n_slots; ++i) {
+        std::uint32_t victim = (slot + i) % n_slots;
+        if (job->slot_node(victim) != node && steal_from(job, victim, slot, index)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Thread_pool::steal_from(Job* job, std::uint32_t victim, std::uint32_t slot, std::uint32_t* index)
+{
+    std::atomic<std::uint64_t>& range = job->m_ranges[victim].range;
+    std::uint64_t v = range;
+    while (true) {
+        std::uint32_t begin = static_cast<std::uint32_t>(v);
+        std::uint32_t end = static_cast<std::uint32_t>(v >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        // take the back half, leaving the victim the tasks it is about to reach
+        std::uint32_t mid = begin + (end - begin) / 2;
+        if (range.compare_exchange_weak(v, pack(begin, mid))) {
+            job->m_ranges[slot].range = pack(mid + 1, end);
+            *index = mid;
+            return true;
+        }
+    }
+}
+
+void Thread_pool::execute(Job* job, std::uint32_t slot)
+{
+    std::uint32_t index;
+    while (pop(job, slot, &index) || steal(job, slot, &index)) {
+        auto start = std::chrono::steady_clock::now();
+        job->m_task->run(index);
+        job->m_busy[slot] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (--job->m_remaining == 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done.notify_all();
+        }
+    }
+}
+
+Thread_pool::Job* Thread_pool::next_job(std::uint32_t node, std::uint32_t* slot)
+{
+    for (std::size_t i = 0; i < m_jobs.size(); ++i) {
+        std::size_t idx = (m_next_job + i) % m_jobs.size();
+        Job* job = m_jobs[idx];
+        if (job->m_exhausted) {
+            continue;
+        }
+        if (job->m_n_nodes == 1) {
+            *slot = job->m_joined[0];
+            node = 0;
+        } else if (node < job->m_n_nodes) {
+            *slot = 1 + node + job->m_joined[node] * job->m_n_nodes;
+        } else {
+            continue;
+        }
+        if (*slot < job->m_n_slots) {
+            job->m_joined[node]++;
+            m_next_job = idx + 1;
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void Thread_pool::worker(std::uint32_t node, std::int32_t cpu)
+{
+#ifdef __linux__
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+        std::uint32_t slot;
+        Job* job = next_job(node, &slot);
+        if (!job) {
+            std::uint32_t seen = m_generation;
+            lock.unlock();
+            for (std::uint32_t i = 0; i < m_spin_count && m_generation == seen; ++i) {
+                cpu_relax();
+            }
+            lock.lock();
+            m_wake.wait(lock, [this, seen] { return m_stop || m_generation != seen; });
+            continue;
+        }
+        job->m_active++;
+        lock.unlock();
+
+        execute(job, slot);
+
+        lock.lock();
+        // nothing left to steal so there's no point in anyone else joining
+        job->m_exhausted = true;
+        if (--job->m_active == 0 && job->m_remaining == 0) {
+            m_done.notify_all();
+        }
+    }
+}
+
+}
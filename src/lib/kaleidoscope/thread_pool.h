@@ -0,0 +1,177 @@
+#ifndef LIBKALEIDOSCOPE_THREAD_POOL_H
+#define LIBKALEIDOSCOPE_THREAD_POOL_H 1
+
+#include "ikaleidoscope.h"
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+namespace libkaleidoscope {
+
+/**
+ * A process wide pool of persistent worker threads shared by every kaleidoscope instance.
+ * Between jobs the workers are parked, spinning briefly before sleeping so back to back
+ * frames wake them with low latency.
+ * Several jobs can run at once, idle workers join them in turn so concurrent instances
+ * share the workers fairly. The tasks of a job are dealt out to its threads in contiguous
+ * runs, a thread that runs out of tasks steals half of the remaining run of another.
+ * Workers can be pinned to cores and, on NUMA machines, each node is dealt a contiguous
+ * band of tasks which its threads work through before stealing from other nodes.
+ */
+class Thread_pool {
+public:
+    /// A job to run on the pool, split into a number of independent tasks
+    class Task {
+    public:
+        /// Run task \p index
+        virtual void run(std::uint32_t index) = 0;
+
+    protected:
+        ~Task() {}
+    };
+
+    /// The scheduling state of a job. Owned by the caller and reused between runs.
+    class Job {
+    public:
+        Job();
+
+        /// Returns the time in seconds each thread spent running tasks in the last run.
+        /// The calling thread is first followed by each worker, workers that didn't
+        /// join report 0.
+        const std::vector<double>& busy_times() const;
+
+    private:
+        friend class Thread_pool;
+
+        Job(const Job&);
+        Job& operator=(const Job&);
+
+        /// A range of task indices, padded to keep each on its own cache line
+        struct Range {
+            std::atomic<std::uint64_t> range;   ///< begin in the low word, end (exclusive) in the high
+            char padding[64 - sizeof(std::atomic<std::uint64_t>)];
+        };
+
+        /// Returns the node of \p slot
+        std::uint32_t slot_node(std::uint32_t slot) const;
+
+        Task* m_task;
+        std::uint32_t m_n_slots;                ///< maximum number of threads to run on
+        std::uint32_t m_n_nodes;                ///< number of nodes the tasks are partitioned over
+        std::uint32_t m_capacity;               ///< number of allocated ranges
+        std::unique_ptr<Range[]> m_ranges;      ///< remaining tasks of each thread, calling thread first
+        std::vector<double> m_busy;             ///< busy time of each thread
+        std::atomic<std::uint32_t> m_remaining; ///< number of tasks not yet completed
+
+        // guarded by the pool mutex
+        std::vector<std::uint32_t> m_joined;    ///< number of slots handed out on each node
+        std::uint32_t m_active;                 ///< number of workers running tasks
+        bool m_exhausted;                       ///< every task has been taken
+    };
+
+    /// Returns the process wide pool
+    static Thread_pool& instance();
+
+    /// Destructor, stops and joins all workers
+    ~Thread_pool();
+
+    /// Resize the pool to \p n_workers worker threads
+    void resize(std::uint32_t n_workers);
+
+    /// Returns the number of worker threads
+    std::uint32_t size() const;
+
+    /// Sets how workers are placed on cores, restarting them if it changes
+    void set_affinity(IKaleidoscope::Affinity affinity);
+
+    /// Returns how workers are placed on cores
+    IKaleidoscope::Affinity get_affinity() const;
+
+    /// Runs tasks \c 0 to \p n_tasks - 1 of \p task and returns once they have all
+    /// completed. The calling thread processes tasks alongside at most \p n_threads - 1 workers.
+    void run(Job* job, Task* task, std::uint32_t n_tasks, std::uint32_t n_threads);
+
+    /// Starts running tasks \c 0 to \p n_tasks - 1 of \p task on at most \p n_threads
+    /// workers and returns immediately. Every started job must be finished with #wait,
+    /// \p job and \p task must remain valid until then.
+    void start(Job* job, Task* task, std::uint32_t n_tasks, std::uint32_t n_threads);
+
+    /// Waits for a job started with #start to complete, helping to process its remaining
+    /// tasks. Jobs are only guaranteed to complete once waited for as the pool may have no
+    /// workers.
+    void wait(Job* job);
+
+private:
+    /// Constructor
+    /// @param n_workers the number of worker threads to start
+    explicit Thread_pool(std::uint32_t n_workers);
+
+    Thread_pool(const Thread_pool&);
+    Thread_pool& operator=(const Thread_pool&);
+
+    /// Prepares \p job to run and hands it to the workers
+    /// @param n_slots the number of threads that can process the job
+    /// @param caller \c true if the calling thread processes the job too, otherwise it is
+    /// left out when dealing out tasks
+    void deal(Job* job, Task* task, std::uint32_t n_tasks, std::uint32_t n_slots, bool caller);
+
+    /// Stops the workers and starts \p n_workers placed according to \p affinity
+    void restart(std::uint32_t n_workers, IKaleidoscope::Affinity affinity);
+
+    /// Worker thread main loop
+    /// @param node the NUMA node of the worker
+    /// @param cpu the cpu to pin the worker to, negative to leave unpinned
+    void worker(std::uint32_t node, std::int32_t cpu);
+
+    /// Returns the next job, in turn, that can take another thread from \p node and
+    /// the slot for it in \p slot. Called with the mutex held.
+    Job* next_job(std::uint32_t node, std::uint32_t* slot);
+
+    /// Processes tasks of \p job until there are none left to run or steal
+    /// @param slot the task range slot of the calling thread
+    void execute(Job* job, std::uint32_t slot);
+
+    /// Takes the next task from the front of range \p slot
+    static bool pop(Job* job, std::uint32_t slot, std::uint32_t* index);
+
+    /// Steals the back half of another thread's range into range \p slot and
+    /// returns the first task of it in \p index. Threads on the same node are
+    /// stolen from first.
+    static bool steal(Job* job, std::uint32_t slot, std::uint32_t* index);
+
+    /// Steals from \p victim into \p slot
+    static bool steal_from(Job* job, std::uint32_t victim, std::uint32_t slot, std::uint32_t* index);
+
+    /// Packs a task range into a single word
+    static std::uint64_t pack(std::uint32_t begin, std::uint32_t end);
+
+    /// Stops and joins all workers
+    void stop();
+
+    std::mutex m_resize_mutex;
+    std::vector<std::thread> m_workers;
+    std::atomic<std::uint32_t> m_n_workers;
+    std::atomic<IKaleidoscope::Affinity> m_affinity;
+    std::atomic<std::uint32_t> m_n_nodes;       ///< number of nodes workers are partitioned over
+    std::vector<std::vector<std::int32_t>> m_topology;  ///< the cpus of each NUMA node
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    std::atomic<std::uint32_t> m_generation;    ///< incremented as each job is started
+    std::vector<Job*> m_jobs;                   ///< jobs workers can join
+    std::size_t m_next_job;                     ///< next job to consider joining
+    bool m_stop;
+
+    std::atomic<std::uint32_t> m_spin_count;    ///< number of times to poll before sleeping
+};
+
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include "tuning.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+#include <iterator>
+
+namespace libkaleidoscope {
+
+/// Largest tile size the online tuner tries
+static const std::uint32_t max_tuned_tile_size = 256;
+/// Smallest tile size the online tuner tries
+static const std::uint32_t min_tuned_tile_size = 16;
+
+Tuning_profile& Tuning_profile::instance()
+{
+    static Tuning_profile profile;
+    return profile;
+}
+
+Tuning_profile::Tuning_profile():
+m_entries(std::make_shared<Entries>())
+{
+    const char* path = std::getenv("KALEIDOSCOPE_TUNING_PROFILE");
+    if (path && *path) {
+        load(path);
+    }
+}
+
+std::int32_t Tuning_profile::load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        return -1;
+    }
+    std::shared_ptr<Entries> entries(std::make_shared<Entries>());
+    std::string line;
+    while (std::getline(file, line)) {
+        std::size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        std::stringstream ss(line);
+        std::uint32_t width, height, pixel_size, segmentation, n_threads, tile_size;
+        std::string mode;
+        ss >> width >> height >> pixel_size >> segmentation >> mode >> n_threads >> tile_size;
+        if (ss.fail() || (mode != "reflect" && mode != "background") || tile_size == 0 || tile_size % 4 != 0) {
+            return -2;
+        }
+        (*entries)[Key(width, height, pixel_size, mode == "reflect", segmentation)] = Tuning(n_threads, tile_size);
+    }
+    std::atomic_store(&m_entries, std::shared_ptr<const Entries>(entries));
+    return 0;
+}
+
+bool Tuning_profile::lookup(std::uint32_t width, std::uint32_t height, std::uint32_t pixel_size, std::uint32_t segmentation, bool reflect, Tuning* tuning) const
+{
+    std::shared_ptr<const Entries> entries(std::atomic_load(&m_entries));
+    if (entries->empty()) {
+        return false;
+    }
+    // entries for the same resolution, pixel size and mode are ordered by segmentation
+    auto first = entries->lower_bound(Key(width, height, pixel_size, reflect, 0));
+    auto next = entries->lower_bound(Key(width, height, pixel_size, reflect, segmentation));
+    auto last = entries->upper_bound(Key(width, height, pixel_size, reflect, UINT32_MAX));
+    if (first == last) {
+        return false;
+    }
+    auto nearest = next;
+    if (next == last || (next != first && segmentation - std::get<4>(std::prev(next)->first) < std::get<4>(next->first) - segmentation)) {
+        nearest = std::prev(next);
+    }
+    *tuning = nearest->second;
+    return true;
+}
+
+Online_tuner::Online_tuner():
+m_key(UINT64_MAX),
+m_max_threads(0),
+m_best_time(-1),
+m_neighbour(0),
+m_total(0),
+m_n_frames(0),
+m_settled(0)
+{
+}
+
+Tuning Online_tuner::next(std::uint64_t key, const Tuning& initial, std::uint32_t max_threads)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (key != m_key || max_threads != m_max_threads) {
+        m_key = key;
+        m_max_threads = max_threads;
+        m_best = Tuning(std::min(std::max(initial.n_threads, 1u), max_threads), initial.tile_size);
+        m_best_time = -1;
+        m_trial = m_best;
+        m_neighbour = 0;
+        m_total = 0;
+        m_n_frames = 0;
+        m_settled = 0;
+    }
+    if (m_settled) {
+        if (--m_settled == 0) {
+            // measure the best choice again and search from there
+            m_best_time = -1;
+            m_trial = m_best;
+            m_neighbour = 0;
+        }
+        return m_best;
+    }
+    return m_trial;
+}
+
+void Online_tuner::record(const Tuning& tuning, double seconds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_settled || tuning != m_trial) {
+        // a frame started before the last change
+        return;
+    }
+    m_total += seconds;
+    if (++m_n_frames < trial_frames) {
+        return;
+    }
+    double mean = m_total / m_n_frames;
+    m_total = 0;
+    m_n_frames = 0;
+    if (m_best_time < 0) {
+        m_best_time = mean;
+    } else if (mean < m_best_time * 0.97) {
+        // only move for a clear improvement so noise doesn't cause wandering
+        m_best = m_trial;
+        m_best_time = mean;
+        m_neighbour = 0;
+    } else {
+        m_neighbour++;
+    }
+    next_candidate();
+}
+
+void Online_tuner::next_candidate()
+{
+    std::uint32_t step = std::max(m_best.n_threads / 4, 1u);
+    for (; m_neighbour < 4; ++m_neighbour) {
+        Tuning candidate(m_best);
+        switch (m_neighbour) {
+        case 0: candidate.n_threads = m_best.n_threads > step ? m_best.n_threads - step : 0; break;
+        case 1: candidate.n_threads = m_best.n_threads + step; break;
+        case 2: candidate.tile_size = m_best.tile_size / 2; break;
+        case 3: candidate.tile_size = m_best.tile_size * 2; break;
+        }
+        if (candidate.n_threads >= 1 && candidate.n_threads <= m_max_threads &&
+            candidate.tile_size >= min_tuned_tile_size && candidate.tile_size <= max_tuned_tile_size &&
+            candidate.tile_size % 4 == 0) {
+            m_trial = candidate;
+            return;
+        }
+    }
+    // no neighbour is faster
+    m_trial = m_best;
+    m_settled = settle_frames;
+}
+
+Deadline_governor::Deadline_governor():
+m_key(UINT64_MAX),
+m_retry(retry_frames)
+{
+    std::fill(m_cost, m_cost + n_levels, -1.0);
+}
+
+std::uint32_t Deadline_governor::next(std::uint64_t key, double deadline)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (key != m_key) {
+        m_key = key;
+        std::fill(m_cost, m_cost + n_levels, -1.0);
+        m_retry = retry_frames;
+    }
+    std::uint32_t level = 0;
+    while (level < n_levels - 1 && m_cost[level] > deadline) {
+        ++level;
+    }
+    if (level == 0) {
+        m_retry = retry_frames;
+    } else if (--m_retry == 0) {
+        // a frame may overrun to find out whether the better level fits again
+        m_retry = retry_frames;
+        m_cost[--level] = -1;
+    }
+    return level;
+}
+
+void Deadline_governor::record(std::uint32_t level, double seconds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (level >= n_levels) {
+        return;
+    }
+    if (m_cost[level] < 0) {
+        m_cost[level] = seconds;
+    } else {
+        m_cost[level] += (seconds - m_cost[level]) / 4;
+    }
+}
+
+}
@@ -0,0 +1,140 @@
+#ifndef LIBKALEIDOSCOPE_TUNING_H
+#define LIBKALEIDOSCOPE_TUNING_H 1
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+namespace libkaleidoscope {
+
+/// A thread count and tile size to process frames with
+struct Tuning {
+    std::uint32_t n_threads;
+    std::uint32_t tile_size;
+
+    Tuning(std::uint32_t _n_threads = 0, std::uint32_t _tile_size = 0):
+        n_threads(_n_threads),
+        tile_size(_tile_size)
+    {}
+
+    bool operator==(const Tuning& other) const { return n_threads == other.n_threads && tile_size == other.tile_size; }
+    bool operator!=(const Tuning& other) const { return !(*this == other); }
+};
+
+/**
+ * The process wide table of the best thread count and tile size for each resolution,
+ * pixel size, segmentation and mode, as measured by <tt>kperf -T</tt>.
+ * The profile is a text file with one entry per line of
+ * <tt>width height pixel_size segmentation mode threads tile_size</tt> where mode is
+ * \c reflect or \c background. Blank lines and lines starting with \c # are ignored and
+ * later entries replace earlier ones for the same key.
+ * It is loaded from the file named by the \c KALEIDOSCOPE_TUNING_PROFILE environment
+ * variable when first used.
+ */
+class Tuning_profile {
+public:
+    /// Returns the process wide profile
+    static Tuning_profile& instance();
+
+    /// Replaces the profile with the contents of \p path
+    /// @return
+    ///          -  0: Success
+    ///          - -1: Error (file could not be read)
+    ///          - -2: Invalid parameter (malformed entry)
+    std::int32_t load(const std::string& path);
+
+    /// Finds the entry for the segmentation nearest to \p segmentation with the given
+    /// resolution, pixel size and mode
+    /// @return \c true if an entry was found
+    bool lookup(std::uint32_t width, std::uint32_t height, std::uint32_t pixel_size, std::uint32_t segmentation, bool reflect, Tuning* tuning) const;
+
+private:
+    /// width, height, pixel size, mode and segmentation
+    typedef std::tuple<std::uint32_t, std::uint32_t, std::uint32_t, bool, std::uint32_t> Key;
+    typedef std::map<Key, Tuning> Entries;
+
+    Tuning_profile();
+
+    Tuning_profile(const Tuning_profile&);
+    Tuning_profile& operator=(const Tuning_profile&);
+
+    std::shared_ptr<const Entries> m_entries;   ///< only accessed with std::atomic_load and std::atomic_store
+};
+
+/**
+ * Tunes the thread count and tile size during a long render. Neighbouring choices are
+ * tried in turn for a few frames each, moving to any that is faster, until none
+ * improve. The search starts again periodically in case the load on the machine changes.
+ */
+class Online_tuner {
+public:
+    Online_tuner();
+
+    /// Returns the choice to process the next frame with.
+    /// @param key identifies the settings being tuned for, the search restarts when it changes
+    /// @param initial the choice to start the search from
+    /// @param max_threads the maximum thread count to try
+    Tuning next(std::uint64_t key, const Tuning& initial, std::uint32_t max_threads);
+
+    /// Records that a frame processed with \p tuning took \p seconds
+    void record(const Tuning& tuning, double seconds);
+
+private:
+    /// Starts trying the next neighbour of the current best choice
+    void next_candidate();
+
+    /// Number of frames each choice is measured over
+    static const std::uint32_t trial_frames = 8;
+    /// Number of frames after settling before searching again
+    static const std::uint32_t settle_frames = 1024;
+
+    std::mutex m_mutex;
+    std::uint64_t m_key;
+    std::uint32_t m_max_threads;
+    Tuning m_best;
+    double m_best_time;             ///< mean frame time of #m_best, negative if not yet measured
+    Tuning m_trial;                 ///< the choice being measured
+    std::uint32_t m_neighbour;      ///< index of the neighbour of #m_best being tried
+    double m_total;                 ///< total time of the frames measured with #m_trial
+    std::uint32_t m_n_frames;       ///< number of frames measured with #m_trial
+    std::uint32_t m_settled;        ///< frames left before searching again, 0 while searching
+};
+
+/**
+ * Chooses the quality level to process each frame at so that frames complete within a
+ * deadline. The cost of each level is tracked as a moving average of its frame times and
+ * the best level predicted to meet the deadline is chosen, levels not yet measured are
+ * tried in turn. The cost of the next better level is forgotten periodically so quality
+ * recovers once the load on the machine drops.
+ */
+class Deadline_governor {
+public:
+    /// Number of quality levels, level 0 is the best and most expensive
+    static const std::uint32_t n_levels = 3;
+
+    Deadline_governor();
+
+    /// Returns the level to process the next frame at.
+    /// @param key identifies the settings being processed with, the costs are forgotten when it changes
+    /// @param deadline the time in seconds a frame must complete in
+    std::uint32_t next(std::uint64_t key, double deadline);
+
+    /// Records that a frame processed at \p level took \p seconds
+    void record(std::uint32_t level, double seconds);
+
+private:
+    /// Number of frames below the best level before trying the next better level again
+    static const std::uint32_t retry_frames = 256;
+
+    std::mutex m_mutex;
+    std::uint64_t m_key;
+    double m_cost[n_levels];    ///< moving average frame time of each level, negative if not measured
+    std::uint32_t m_retry;      ///< frames left before trying the next better level again
+};
+
+}
+
+#endif